@@ -32,4 +32,17 @@ static constexpr int LUA_ERRGCMM	= 5;
 static constexpr int LUA_ERRERR		= 6;
 static constexpr int LUA_ERRFILE	= 7;
 
+/* options for LuaState::GC */
+static constexpr int LUA_GCSTOP			= 0;
+static constexpr int LUA_GCRESTART		= 1;
+static constexpr int LUA_GCCOLLECT		= 2;
+static constexpr int LUA_GCCOUNT		= 3;
+static constexpr int LUA_GCCOUNTB		= 4;
+static constexpr int LUA_GCSTEP			= 5;
+static constexpr int LUA_GCSETPAUSE		= 6;
+static constexpr int LUA_GCSETSTEPMUL	= 7;
+static constexpr int LUA_GCISRUNNING	= 9;
+static constexpr int LUA_GCGEN			= 10;
+static constexpr int LUA_GCINC			= 11;
+
 inline int LuaUpvalueIndex(int i) { return LUA_REGISTRYINDEX - i; }
\ No newline at end of file
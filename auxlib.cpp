@@ -2,6 +2,9 @@
 #include "stdlib/lib_basic.h"
 #include "stdlib/lib_package.h"
 #include "stdlib/lib_coroutine.h"
+#include "stdlib/lib_string.h"
+#include "stdlib/lib_table.h"
+#include "binchunk/mapped_file.h"
 
 int LuaState::Error2(const char* fmt, ...)
 {
@@ -137,33 +140,17 @@ int LuaState::LoadFile(const String& filename)
 
 int LuaState::LoadFileX(const String& filename, const String& mode)
 {
-	FILE* f = fopen(filename.c_str(), "rb");
-	if (f)
+	MappedFile file;
+	if(file.Open(filename))
 	{
-		fseek(f, 0, SEEK_END);
-		long size = ftell(f);
-		fseek(f, 0, SEEK_SET);
-
-		ByteArray chunk;
-		chunk.resize(size);
-		fread(chunk.data(), 1, size, f);
-		fclose(f);
-		f = NULL;
-
-		return Load(chunk, "@" + filename, mode);
+		return Load(file.Data(), file.Size(), "@" + filename, mode);
 	}
 	return LUA_ERRFILE;
 }
 
 int LuaState::LoadString(const String& s)
 {
-	ByteArray chunk;
-	chunk.reserve(s.size());
-	for(const Byte& c : s)
-	{
-		chunk.push_back(c);
-	}
-	return Load(chunk, s, "bt");
+	return Load((const Byte*)s.data(), s.size(), s, "bt");
 }
 
 String LuaState::TypeName2(int idx)
@@ -184,11 +171,9 @@ String LuaState::ToString2(int idx)
 		{
 			case LUA_TNUMBER:
 			{
-				if(IsInteger(idx))
-					PushString(Format::FormatString("%d", ToInteger(idx)));
-				else
-					PushString(Format::FormatString("%f", ToNumber(idx)));
-				break;				
+				char buf[MAXNUMBER2STR];
+				PushString(String(buf, NumberToChars(stack->Get(idx), buf)));
+				break;
 			}
 			case LUA_TSTRING:
 			{
@@ -318,6 +303,8 @@ void LuaState::OpenLibs()
 		{"_G", OpenBaseLib},
 		{"package", OpenPackageLib},
 		{"coroutine", OpenCoroutineLib},
+		{"string", OpenStringLib},
+		{"table", OpenTableLib},
 		{nullptr, nullptr}
 	};
 
@@ -0,0 +1,34 @@
+-- allocation heavy: builds and walks complete binary trees of small tables
+local function bottomUpTree(depth)
+	if depth > 0 then
+		depth = depth - 1
+		local left, right = bottomUpTree(depth), bottomUpTree(depth)
+		return { left, right }
+	else
+		return { }
+	end
+end
+
+local function itemCheck(tree)
+	if tree[1] then
+		return 1 + itemCheck(tree[1]) + itemCheck(tree[2])
+	else
+		return 1
+	end
+end
+
+local mindepth = 4
+local maxdepth = 12
+local stretchdepth = maxdepth + 1
+print("stretch tree of depth", stretchdepth, "check:", itemCheck(bottomUpTree(stretchdepth)))
+
+local longlived = bottomUpTree(maxdepth)
+for depth = mindepth, maxdepth, 2 do
+	local iters = 1 << (maxdepth - depth + mindepth)
+	local check = 0
+	for i = 1, iters do
+		check = check + itemCheck(bottomUpTree(depth))
+	end
+	print(iters, "trees of depth", depth, "check:", check)
+end
+print("long lived tree of depth", maxdepth, "check:", itemCheck(longlived))
@@ -0,0 +1,32 @@
+-- short calls through closures sharing upvalues, methods and varargs
+local function counter()
+	local n = 0
+	return function(d)
+		n = n + d
+		return n
+	end
+end
+
+local Point = {}
+Point.__index = Point
+function Point:move(dx, dy)
+	self.x = self.x + dx
+	self.y = self.y + dy
+	return self
+end
+
+local function sum(...)
+	local a, b, c = ...
+	return a + b + c
+end
+
+local inc = counter()
+local p = setmetatable({ x = 0, y = 0 }, Point)
+local total = 0
+for i = 1, 300000 do
+	local add = counter()
+	add(i)
+	total = total + inc(1) + add(1) + sum(i, 1, 2)
+	p:move(1, -1)
+end
+print(total, p.x, p.y)
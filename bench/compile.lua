@@ -0,0 +1,20 @@
+-- parse and code generation: load a generated module many times without running it
+local src = ""
+for i = 1, 40 do
+	src = src .. "local function f" .. i .. "(a, b, ...)\n"
+		.. "\tlocal t = { x = a, y = b, " .. i .. ", \"s" .. i .. "\" }\n"
+		.. "\tfor k = 1, #t do t[k] = (t[k] or 0) * 2 + a % 3 end\n"
+		.. "\tif a > b and not t.z then return a .. b, select(\"#\", ...) else return t.x + t.y end\n"
+		.. "end\n"
+end
+src = src .. "return f1"
+
+local n = 0
+for i = 1, 300 do
+	-- a different text each time, identical chunks would share one prototype
+	local f = load(src .. " -- " .. i, "=gen")
+	if f then
+		n = n + 1
+	end
+end
+print(n, #src)
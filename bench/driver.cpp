@@ -0,0 +1,124 @@
+// Standalone interpreter: runs every script given on the command line in its own state
+// and reports the wall time and, when built with LUA_COUNT_INSTRUCTIONS, the instructions per second.
+// Like luac, "-o out.luac [-s] script.lua" only compiles the script and saves it as a binary chunk.
+// With LUA_CHUNK_CACHE set to an existing directory compiled chunks are cached there.
+// "-i script.lua ..." prints how many instructions each script compiles to (see make instcount).
+#include "state/lua_state.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+static int Compile(const char* output, bool strip, const char* script)
+{
+	LuaStatePtr ls = NewLuaState();
+	if(ls->LoadFile(script) != LUA_OK)
+	{
+		printf("%s: cannot load %s\n", output, script);
+		return 1;
+	}
+	ByteArray chunk;
+	ls->Dump(chunk, strip);
+	FILE* f = fopen(output, "wb");
+	if(f == NULL || fwrite(chunk.data(), 1, chunk.size(), f) != chunk.size())
+	{
+		printf("cannot write %s\n", output);
+		if(f)
+			fclose(f);
+		return 1;
+	}
+	fclose(f);
+	return 0;
+}
+
+static size_t CountInstructions(const Prototype* proto)
+{
+	size_t n = proto->Code.size();
+	for(const PrototypePtr& sub : proto->Protos)
+		n += CountInstructions(sub.get());
+	return n;
+}
+
+static int PrintInstructionCounts(int argc, char** argv)
+{
+	int failed = 0;
+	for(int i = 2; i < argc; ++i)
+	{
+		LuaStatePtr ls = NewLuaState();
+		if(ls->LoadFile(argv[i]) != LUA_OK)
+		{
+			printf("%s error\n", argv[i]);
+			++failed;
+			continue;
+		}
+		printf("%s %zu\n", argv[i], CountInstructions(ls->ToProto(-1).get()));
+	}
+	return failed > 0 ? 2 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		printf("usage: %s script.lua ...\n", argv[0]);
+		printf("       %s -o out.luac [-s] script.lua\n", argv[0]);
+		printf("       %s -i script.lua ...\n", argv[0]);
+		return 1;
+	}
+
+	if(strcmp(argv[1], "-i") == 0)
+		return PrintInstructionCounts(argc, argv);
+
+	if(strcmp(argv[1], "-o") == 0)
+	{
+		bool strip = argc == 5 && strcmp(argv[3], "-s") == 0;
+		if(argc != (strip ? 5 : 4))
+		{
+			printf("usage: %s -o out.luac [-s] script.lua\n", argv[0]);
+			return 1;
+		}
+		return Compile(argv[2], strip, argv[argc - 1]);
+	}
+
+	const char* cacheDir = getenv("LUA_CHUNK_CACHE");
+	if(cacheDir && cacheDir[0])
+		g_chunkcache.SetDirectory(cacheDir);
+
+	int failed = 0;
+	for(int i = 1; i < argc; ++i)
+	{
+		LuaStatePtr ls = NewLuaState();
+		ls->OpenLibs();
+
+		UInt64 instcount = g_instcount;
+		auto start = std::chrono::steady_clock::now();
+		int status = ls->LoadFile(argv[i]);
+		if(status == LUA_OK)
+			status = ls->PCall(0, 0, 0);
+		auto end = std::chrono::steady_clock::now();
+		double ms = std::chrono::duration<double, std::milli>(end - start).count();
+		instcount = g_instcount - instcount;
+
+		if(status != LUA_OK)
+		{
+			++failed;
+			printf("%-28s error: %s\n", argv[i], ls->ToString(-1).c_str());
+			continue;
+		}
+		if(instcount > 0)
+		{
+			printf("%-28s %10.1f ms %14llu inst %10.1f Minst/s\n", argv[i], ms,
+				(unsigned long long)instcount, instcount / ms / 1000.0);
+		}
+		else
+		{
+			printf("%-28s %10.1f ms\n", argv[i], ms);
+		}
+		fflush(stdout);
+	}
+	if(g_chunkcache.Enabled())
+	{
+		printf("chunk cache %s: %llu hits, %llu misses, %llu shared\n", g_chunkcache.Directory().c_str(),
+			g_chunkcache.Hits(), g_chunkcache.Misses(), g_chunkcache.Shared());
+	}
+	return failed > 0 ? 2 : 0;
+}
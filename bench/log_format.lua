@@ -0,0 +1,14 @@
+-- log lines built from many pieces with one concatenation each, then joined with table.concat
+local levels = {"debug", "info", "warn", "error"}
+local total = 0
+for n = 1, 50 do
+	local lines = {}
+	for i = 1, 1000 do
+		local level = levels[i % 4 + 1]
+		lines[i] = "[" .. n .. ":" .. i .. "] " .. level .. " request=" .. (i * 7919) % 10007 ..
+			" user=u" .. i % 97 .. " bytes=" .. i * 13 .. " elapsed=" .. i / 8 .. "ms path=/api/v1/items/" .. i
+	end
+	local text = table.concat(lines, "\n")
+	total = total + #text
+end
+print(total)
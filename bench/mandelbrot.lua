@@ -0,0 +1,30 @@
+-- float arithmetic in a tight loop, the bitmap is packed with integer ops and summed up
+local N = 200
+local ITER = 50
+local checksum = 0
+for y = 0, N - 1 do
+	local ci = 2.0 * y / N - 1.0
+	local bits, nbits = 0, 0
+	for x = 0, N - 1 do
+		local cr = 2.0 * x / N - 1.5
+		local zr, zi, zr2, zi2 = 0.0, 0.0, 0.0, 0.0
+		local inside = 1
+		for i = 1, ITER do
+			zi = 2.0 * zr * zi + ci
+			zr = zr2 - zi2 + cr
+			zr2 = zr * zr
+			zi2 = zi * zi
+			if zr2 + zi2 > 4.0 then
+				inside = 0
+				break
+			end
+		end
+		bits = (bits << 1) | inside
+		nbits = nbits + 1
+		if nbits == 8 then
+			checksum = (checksum * 31 + bits) % 1000000007
+			bits, nbits = 0, 0
+		end
+	end
+end
+print(N, checksum)
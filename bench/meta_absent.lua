@@ -0,0 +1,29 @@
+-- objects with a metatable that lacks most metamethods: equality, length, missing keys and new fields
+local Node = {__index = {kind = "node"}}
+local Item = {__tostring = function() return "item" end}
+
+local items = {}
+for i = 1, 500 do
+	local it = setmetatable({}, Item)
+	it.id = i
+	it.weight = i % 7
+	it.next = items[i - 1]
+	items[i] = it
+end
+
+local count = 0
+local node = setmetatable({}, Node)
+for n = 1, 400 do
+	for i = 2, #items do
+		local it = items[i]
+		if it ~= items[i - 1] and it.next == items[i - 1] and #it == 0 and it.missing == nil then
+			count = count + it.weight
+		end
+		if node.kind == "node" and node.extra == nil then
+			count = count + 1
+		end
+	end
+	local tmp = setmetatable({}, Item)
+	tmp.a, tmp.b, tmp.c = n, n, n
+end
+print(count)
@@ -0,0 +1,12 @@
+-- register moves and arithmetic on locals, no tables or calls in the loop
+local a, b, c, d = 1, 2, 3.5, 0
+local n = 0
+while n < 2000000 do
+	local t = a
+	a = b
+	b = t
+	d = d + a * 2 - b
+	c = c * 0.5 + 1.25
+	n = n + 1
+end
+print(a, b, c, d)
@@ -0,0 +1,52 @@
+-- method calls on objects of a small class hierarchy, fields and methods found through __index
+local Point = {}
+Point.__index = Point
+
+function Point.new(x, y)
+	return setmetatable({x = x, y = y}, Point)
+end
+
+function Point:add(o)
+	return Point.new(self.x + o.x, self.y + o.y)
+end
+
+function Point:dot(o)
+	return self.x * o.x + self.y * o.y
+end
+
+local Particle = setmetatable({}, {__index = Point})
+Particle.__index = Particle
+
+function Particle.new(x, y, vx, vy)
+	local p = setmetatable({x = x, y = y}, Particle)
+	p.v = Point.new(vx, vy)
+	return p
+end
+
+function Particle:step()
+	self.x = self.x + self.v.x
+	self.y = self.y + self.v.y
+	if self.x < 0 or self.x > 100 then self.v.x = -self.v.x end
+	if self.y < 0 or self.y > 100 then self.v.y = -self.v.y end
+end
+
+function Particle:energy()
+	return self.v:dot(self.v)
+end
+
+local particles = {}
+for i = 1, 100 do
+	particles[i] = Particle.new(i % 100, (i * 7) % 100, i % 5 - 2, i % 3 - 1)
+end
+
+local sum = 0
+local center = Point.new(0, 0)
+for n = 1, 2000 do
+	for i = 1, #particles do
+		local p = particles[i]
+		p:step()
+		sum = sum + p:energy() + p:dot(center)
+	end
+	center = center:add(Point.new(1, 1))
+end
+print(sum, center.x, center.y)
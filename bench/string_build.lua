@@ -0,0 +1,12 @@
+-- concatenation of short strings and numbers into longer ones
+local total = 0
+local last
+for i = 1, 20000 do
+	local line = "line" .. i .. ":"
+	for j = 1, 20 do
+		line = line .. " " .. j
+	end
+	total = total + #line
+	last = line
+end
+print(total, #last)
@@ -0,0 +1,19 @@
+-- tables created, filled through the array and hash parts, emptied and traversed
+local total = 0
+for round = 1, 100 do
+	local t = {}
+	for i = 1, 1000 do
+		t[i] = i
+	end
+	for i = 1, 1000 do
+		t["k" .. i] = i
+	end
+	for i = 1, 1000, 2 do
+		t[i] = nil
+		t["k" .. i] = nil
+	end
+	for k, v in pairs(t) do
+		total = total + v
+	end
+end
+print(total)
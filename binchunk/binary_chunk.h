@@ -1,6 +1,7 @@
 #pragma once
 #include "public.h"
 #include "vm/opcodes.h"
+#include "state/lua_value.h"
 #include <vector>
 #include <memory>
 
@@ -65,6 +66,19 @@ struct Constant
 		tag = TAG_NIL;
 		luaInteger = 0;
 	}
+
+	LuaValue Value() const
+	{
+		switch(tag)
+		{
+			case TAG_BOOLEAN: return LuaValue(boolean);
+			case TAG_NUMBER: return LuaValue(luaNum);
+			case TAG_INTEGER: return LuaValue(luaInteger);
+			case TAG_SHORT_STR:
+			case TAG_LONG_STR: return LuaValue(str);
+			default: return LuaValue::Nil;
+		}
+	}
 };
 
 struct Upvalue
@@ -91,6 +105,21 @@ struct LocVar
 	UInt32 EndPC;
 };
 
+// Lookup cache of an instruction indexing or assigning a table with a constant string.
+// Slots of hash parts are remembered and a slot is only used while it still holds the key,
+// so an entry is never invalidated, a stale one just misses.
+struct InlineCache
+{
+	// slot of the key in the indexed table
+	int slot;
+	// slot of __index in its metatable and of the key in that __index table
+	int indexSlot;
+	int inheritedSlot;
+};
+
+// Never modified once loaded or compiled (PrototypePtr points to const),
+// so closures of any state can share one prototype. Caches is the exception,
+// it only holds lookup hints.
 struct Prototype
 {
 	String Source;
@@ -106,6 +135,38 @@ struct Prototype
 	std::vector<UInt32> LineInfo;
 	std::vector<LocVar> LocVars;
 	std::vector<std::string> UpvalueNames;
+	// Constants as VM values, filled once by Materialize. The collector keeps their strings
+	// alive for as long as the prototype exists, whichever state it is used from.
+	std::vector<LuaValue> K;
+	// One entry per instruction, used by the table access instructions
+	mutable std::vector<InlineCache> Caches;
+
+	Prototype()
+	{
+		LineDefined = 0;
+		LastLineDefined = 0;
+		NumParams = 0;
+		IsVararg = 0;
+		MaxStackSize = 0;
+		g_gc.AddProto(this);
+	}
+
+	~Prototype()
+	{
+		g_gc.RemoveProto(this);
+	}
+
+	Prototype(const Prototype&) = delete;
+	Prototype& operator=(const Prototype&) = delete;
+
+	void Materialize()
+	{
+		K.resize(Constants.size());
+		for(size_t i = 0; i < Constants.size(); ++i)
+			K[i] = Constants[i].Value();
+		InlineCache empty = { -1, -1, -1 };
+		Caches.assign(Code.size(), empty);
+	}
 
 	void PrintHeader() const
 	{
@@ -0,0 +1,213 @@
+#pragma once
+#include "binary_chunk.h"
+#include "mapped_file.h"
+#include "reader.h"
+#include "writer.h"
+#include "compiler/compiler.h"
+#include <cstdio>
+#include <unordered_map>
+
+// Bump whenever the code generator changes what it emits, old cache entries are then never found
+#define LUA_COMPILER_VERSION "mylua-codegen-4"
+
+// Where source chunks get their prototype from instead of compiling them every time.
+// A chunk is identified by a hash of the compiler version, its name and its text. Since two chunks
+// may share that hash, an entry also records the size of the text and a second, unrelated hash of
+// it, a hit whose size or second hash differs from the chunk being loaded is a miss.
+// - In memory: a prototype still used by some state is shared with any other state loading the same chunk.
+// - On disk, when a directory is set: shared by every process using it. An entry holds the dumped
+//   prototype, the size and second hash of its source and a checksum of all that, so a damaged
+//   entry is a miss, not an error.
+//   Entries are written to a temporary file and renamed into place.
+class ChunkCache
+{
+protected:
+	String directory;
+	UInt64 hits;
+	UInt64 misses;
+	UInt64 shared;
+	static const UInt64 FNV_OFFSET = 14695981039346656037ULL;
+	static const UInt64 CHECK_OFFSET = 0x9E3779B97F4A7C15ULL;
+
+	struct Source
+	{
+		UInt64 key;
+		UInt64 size;
+		UInt64 check;
+		bool operator==(const Source& rhs) const { return key == rhs.key && size == rhs.size && check == rhs.check; }
+	};
+	struct Entry
+	{
+		Source source;
+		std::weak_ptr<const Prototype> proto;
+	};
+	std::unordered_map<UInt64, Entry> loaded;
+	// expired entries of loaded are dropped when it grows past this
+	size_t loadedLimit;
+
+	static UInt64 _Hash(const Byte* bytes, size_t size, UInt64 h = FNV_OFFSET)
+	{
+		// FNV-1a
+		for(size_t i = 0; i < size; ++i)
+		{
+			h ^= bytes[i];
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+
+	static UInt64 _Check(const Byte* bytes, size_t size, UInt64 h = CHECK_OFFSET)
+	{
+		// shares no constants with _Hash so the two do not collide together
+		for(size_t i = 0; i < size; ++i)
+		{
+			h = (h ^ bytes[i]) * 0xFF51AFD7ED558CCDULL;
+			h ^= h >> 29;
+		}
+		return h;
+	}
+
+	static UInt64 _Digest(UInt64 (*hash)(const Byte*, size_t, UInt64), UInt64 h, const Byte* chunk, size_t size, const String& chunkName)
+	{
+		const char* version = LUA_COMPILER_VERSION;
+		h = hash((const Byte*)version, strlen(version), h);
+		h = hash(&CSIZE_SIZE, 1, h);
+		// the name ends up in the prototype as its source
+		h = hash((const Byte*)chunkName.c_str(), chunkName.size() + 1, h);
+		h = hash((const Byte*)&size, sizeof(size), h);
+		return hash(chunk, size, h);
+	}
+
+	static Source _Identify(const Byte* chunk, size_t size, const String& chunkName)
+	{
+		Source source;
+		source.key = _Digest(_Hash, FNV_OFFSET, chunk, size, chunkName);
+		source.size = size;
+		source.check = _Digest(_Check, CHECK_OFFSET, chunk, size, chunkName);
+		return source;
+	}
+
+	String _Path(UInt64 key) const
+	{
+		return directory + Format::FormatString("/%016llx.luac", key);
+	}
+
+	void _Share(const Source& source, const PrototypePtr& proto)
+	{
+		if(loaded.size() >= loadedLimit)
+		{
+			for(auto it = loaded.begin(); it != loaded.end();)
+			{
+				if(it->second.proto.expired())
+					it = loaded.erase(it);
+				else
+					++it;
+			}
+			loadedLimit = std::max((size_t)64, loaded.size() * 2);
+		}
+		Entry& entry = loaded[source.key];
+		entry.source = source;
+		entry.proto = proto;
+	}
+public:
+	ChunkCache()
+	{
+		hits = 0;
+		misses = 0;
+		shared = 0;
+		loadedLimit = 64;
+	}
+
+	// An empty directory turns the cache off, it is off by default
+	void SetDirectory(const String& dir)
+	{
+		directory = dir;
+		while(directory.size() > 1 && (directory.back() == '/' || directory.back() == '\\'))
+			directory.pop_back();
+	}
+
+	const String& Directory() const { return directory; }
+	bool Enabled() const { return !directory.empty(); }
+	UInt64 Hits() const { return hits; }
+	UInt64 Misses() const { return misses; }
+	// loads served by a prototype already in memory
+	UInt64 Shared() const { return shared; }
+
+	void ResetCounters()
+	{
+		hits = 0;
+		misses = 0;
+		shared = 0;
+	}
+
+	// The prototype of a source chunk: one already in memory, from the directory or newly compiled
+	PrototypePtr Load(const Byte* chunk, size_t size, const String& chunkName)
+	{
+		Source source = _Identify(chunk, size, chunkName);
+		auto it = loaded.find(source.key);
+		if(it != loaded.end() && it->second.source == source)
+		{
+			PrototypePtr proto = it->second.proto.lock();
+			if(proto)
+			{
+				++shared;
+				return proto;
+			}
+		}
+
+		PrototypePtr proto = Enabled() ? Find(source) : nullptr;
+		if(proto == nullptr)
+		{
+			proto = Compile((const char*)chunk, size, chunkName);
+			if(Enabled())
+				Store(source, proto.get());
+		}
+		_Share(source, proto);
+		return proto;
+	}
+
+	// The prototype stored in the directory for that source, nullptr on a miss
+	PrototypePtr Find(const Source& source)
+	{
+		MappedFile file;
+		if(file.Open(_Path(source.key)) && file.Size() > 3 * sizeof(UInt64))
+		{
+			size_t payload = file.Size() - 3 * sizeof(UInt64);
+			UInt64 trailer[3];
+			memcpy(trailer, file.Data() + payload, sizeof(trailer));
+			if(trailer[2] == _Hash(file.Data(), payload + 2 * sizeof(UInt64)) &&
+				trailer[0] == source.size && trailer[1] == source.check)
+			{
+				++hits;
+				return Undump(file.Data(), payload);
+			}
+		}
+		++misses;
+		return nullptr;
+	}
+
+	void Store(const Source& source, const Prototype* proto)
+	{
+		String path = _Path(source.key);
+#ifdef _WIN32
+		unsigned long pid = (unsigned long)GetCurrentProcessId();
+#else
+		unsigned long pid = (unsigned long)getpid();
+#endif
+		String temp = path + Format::FormatString(".%lu.tmp", pid);
+		ByteArray data = Dump(proto);
+		UInt64 trailer[3] = { source.size, source.check, 0 };
+		trailer[2] = _Hash((const Byte*)trailer, 2 * sizeof(UInt64), _Hash(data.data(), data.size()));
+		FILE* f = fopen(temp.c_str(), "wb");
+		if(f == NULL)
+			return;
+		bool written = fwrite(data.data(), 1, data.size(), f) == data.size() &&
+			fwrite(trailer, 1, sizeof(trailer), f) == sizeof(trailer);
+		written = fclose(f) == 0 && written;
+		// another process may have stored the same entry meanwhile, either copy will do
+		if(!written || rename(temp.c_str(), path.c_str()) != 0)
+			remove(temp.c_str());
+	}
+};
+
+extern ChunkCache g_chunkcache;
@@ -0,0 +1,146 @@
+#pragma once
+#include "public.h"
+#include <cstdio>
+#ifdef _WIN32
+#	ifndef NOMINMAX
+#		define NOMINMAX
+#	endif
+#	ifndef WIN32_LEAN_AND_MEAN
+#		define WIN32_LEAN_AND_MEAN
+#	endif
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+// Read only bytes of a whole file, valid until Close or destruction.
+// Regular files are mapped into memory so that the loader parses them in place,
+// anything that can't be mapped (pipes, empty files) is read into a buffer instead.
+class MappedFile
+{
+protected:
+	const Byte* data;
+	size_t size;
+	bool mapped;
+	ByteArray buffer;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+
+	bool _Map(const String& filename)
+	{
+#ifdef _WIN32
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if(file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		if(GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+		{
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if(mapping)
+			{
+				const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				if(view)
+				{
+					data = (const Byte*)view;
+					size = (size_t)fileSize.QuadPart;
+					mapped = true;
+					return true;
+				}
+				CloseHandle(mapping);
+				mapping = NULL;
+			}
+		}
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+		return false;
+#else
+		int fd = open(filename.c_str(), O_RDONLY);
+		if(fd < 0)
+			return false;
+		struct stat st;
+		if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+		{
+			void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(view != MAP_FAILED)
+			{
+				// the mapping stays valid without the descriptor
+				close(fd);
+				data = (const Byte*)view;
+				size = (size_t)st.st_size;
+				mapped = true;
+				return true;
+			}
+		}
+		close(fd);
+		return false;
+#endif
+	}
+
+	bool _Read(const String& filename)
+	{
+		FILE* f = fopen(filename.c_str(), "rb");
+		if(f == NULL)
+			return false;
+		Byte block[4096];
+		size_t n = 0;
+		while((n = fread(block, 1, sizeof(block), f)) > 0)
+			buffer.insert(buffer.end(), block, block + n);
+		fclose(f);
+		data = buffer.data();
+		size = buffer.size();
+		return true;
+	}
+public:
+	MappedFile()
+	{
+		data = nullptr;
+		size = 0;
+		mapped = false;
+#ifdef _WIN32
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#endif
+	}
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const String& filename)
+	{
+		Close();
+		return _Map(filename) || _Read(filename);
+	}
+
+	void Close()
+	{
+		if(mapped)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(data);
+			CloseHandle(mapping);
+			CloseHandle(file);
+			mapping = NULL;
+			file = INVALID_HANDLE_VALUE;
+#else
+			munmap(const_cast<Byte*>(data), size);
+#endif
+			mapped = false;
+		}
+		buffer.clear();
+		data = nullptr;
+		size = 0;
+	}
+
+	const Byte* Data() const { return data; }
+	size_t Size() const { return size; }
+};
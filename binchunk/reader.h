@@ -1,5 +1,7 @@
 #pragma once
 #include "binary_chunk.h"
+#include "state/lua_string.h"
+#include "vm/verifier.h"
 
 inline bool bytesEqual(const Byte* lhs, const Byte* rhs, size_t len)
 {
@@ -13,55 +15,77 @@ inline bool bytesEqual(const Byte* lhs, const Byte* rhs, size_t len)
 	return false;
 }
 
+// Deepest prototype nesting accepted from a precompiled chunk
+const int LUAI_MAXNESTING = 200;
+// Smallest encoding of a prototype: the source, LineDefined and LastLineDefined,
+// NumParams, IsVararg and MaxStackSize, and the counts of its seven arrays
+const size_t MIN_PROTO_SIZE = 1 + 2 * sizeof(UInt32) + 3 + 7 * sizeof(UInt32);
+
+// Parses a precompiled chunk in place, the bytes are borrowed and must outlive the reader
 struct Reader
 {
-	ByteArray data;
+	const Byte* data;
+	size_t size;
 	size_t pos;
+	// nesting of the prototype being read
+	int depth;
 
-	Reader(const ByteArray& _data)
+	Reader(const Byte* _data, size_t _size)
 	{
 		data = _data;
+		size = _size;
 		pos = 0;
+		depth = 0;
 	}
 
 	Byte ReadByte()
 	{
-		if(pos < data.size())
+		if(pos < size)
 		{
 			return data[pos++];
 		}
 		return 0;
 	}
 
+	// Consumes byteCount bytes and returns where they start
+	const Byte* _Skip(size_t byteCount)
+	{
+		panic_cond(byteCount <= size - pos, "truncated precompiled chunk");
+		const Byte* bytes = data + pos;
+		pos += byteCount;
+		return bytes;
+	}
+
 	void _ReadBytes(size_t byteCount, Byte* dest, bool littleEndian = true)
 	{
-		if(pos + byteCount < data.size())
+		const Byte* bytes = _Skip(byteCount);
+		if(littleEndian)
+		{
+			memcpy(dest, bytes, byteCount);
+		}
+		else
 		{
-			if(dest)
-			{
-				if(littleEndian)
-				{
-					for(size_t i = 0; i < byteCount; ++i)
-						dest[i] = data[pos++];
-				}
-				else
-				{
-					for(size_t i = 0; i < byteCount; ++i)
-						dest[byteCount - i - 1] = data[pos++];
-				}
-			}
-			else
-			{
-				pos += byteCount;	
-			}	
+			for(size_t i = 0; i < byteCount; ++i)
+				dest[byteCount - i - 1] = bytes[i];
 		}
 	}
 
-	ByteArray ReadBytes(size_t bytes, bool littleEndian = true)
+	// Element count of an array, checked against the bytes left before anything is allocated.
+	// minSize is the smallest encoding of an element.
+	UInt32 _ReadCount(size_t minSize)
 	{
-		ByteArray array;
-		array.resize(bytes);
-		_ReadBytes(bytes, array.data(), littleEndian);
+		UInt32 count = ReadUInt();
+		panic_cond(count <= (size - pos) / minSize, "truncated precompiled chunk");
+		return count;
+	}
+
+	// The header has checked that the chunk matches this machine, arrays of UInt32 are copied at once
+	std::vector<UInt32> _ReadUIntArray()
+	{
+		UInt32 count = _ReadCount(sizeof(UInt32));
+		std::vector<UInt32> array(count);
+		if(count > 0)
+			memcpy(array.data(), _Skip(count * sizeof(UInt32)), count * sizeof(UInt32));
 		return array;
 	}
 
@@ -114,27 +138,18 @@ struct Reader
 		}
 		--size;
 
-		String bytes;
-		bytes.resize(size);
-		_ReadBytes(size, const_cast<Byte*>((const Byte*)bytes.data()), true);
-		return bytes;
+		return String((const char*)_Skip(size), size);
 	}
 
 	std::vector<UInt32> ReadCode()
 	{
-		UInt32 count = ReadUInt();
-		std::vector<UInt32> code;
-		code.resize(count);
-		for(UInt32 i = 0; i < count; ++i)
-		{
-			code[i] = ReadUInt();
-		}
-		return code;
+		return _ReadUIntArray();
 	}
 
 	std::vector<Constant> ReadConstants()
 	{
-		UInt32 count = ReadUInt();
+		// a tag byte
+		UInt32 count = _ReadCount(1);
 		std::vector<Constant> constants;
 		constants.resize(count);
 		for(UInt32 i = 0; i < count; ++i)
@@ -167,13 +182,17 @@ struct Reader
 			case TAG_LONG_STR:
 				constant.str = ReadString();
 				break;
+			default:
+				panic("invalid constant in precompiled chunk");
+				break;
 		}
 		return constant;
 	}
 
 	std::vector<Upvalue> ReadUpvalues()
 	{
-		UInt32 count = ReadUInt();
+		// instack and index bytes
+		UInt32 count = _ReadCount(2);
 		std::vector<Upvalue> upvalues;
 		upvalues.resize(count);
 		for(UInt32 i = 0; i < count; ++i)
@@ -186,7 +205,7 @@ struct Reader
 
 	std::vector<PrototypePtr> ReadProtos(const String& parentSource)
 	{
-		UInt32 count = ReadUInt();
+		UInt32 count = _ReadCount(MIN_PROTO_SIZE);
 		std::vector<PrototypePtr> protos;
 		protos.resize(count);
 		for(UInt32 i = 0; i < count; ++i)
@@ -198,19 +217,13 @@ struct Reader
 
 	std::vector<UInt32> ReadLineInfo()
 	{
-		UInt32 count = ReadUInt();
-		std::vector<UInt32> lineInfos;
-		lineInfos.resize(count);
-		for(UInt32 i = 0; i < count; ++i)
-		{
-			lineInfos[i] = ReadUInt();
-		}
-		return lineInfos;
+		return _ReadUIntArray();
 	}
 
 	std::vector<LocVar> ReadLocVars()
 	{
-		UInt32 count = ReadUInt();
+		// a name and two pcs
+		UInt32 count = _ReadCount(1 + 2 * sizeof(UInt32));
 		std::vector<LocVar> locVars;
 		locVars.resize(count);
 		for(UInt32 i = 0; i < count; ++i)
@@ -224,7 +237,8 @@ struct Reader
 
 	std::vector<String> ReadUpvalueNames()
 	{
-		UInt32 count = ReadUInt();
+		// a name
+		UInt32 count = _ReadCount(1);
 		std::vector<String> names;
 		names.resize(count);
 		for(UInt32 i = 0; i < count; ++i)
@@ -236,7 +250,7 @@ struct Reader
 
 	void CheckHeader()
 	{
-		if(!bytesEqual(ReadBytes(4).data(), LUA_SIGNATURE, 4))
+		if(!bytesEqual(_Skip(4), LUA_SIGNATURE, 4))
 		{
 			panic("not a precompiled chunk!");
 		}
@@ -248,7 +262,7 @@ struct Reader
 		{
 			panic("format mismatch");
 		}
-		else if(!bytesEqual(ReadBytes(6).data(), LUAC_DATA, 6))
+		else if(!bytesEqual(_Skip(6), LUAC_DATA, 6))
 		{
 			panic("corrupted!");
 		}
@@ -284,12 +298,14 @@ struct Reader
 
 	PrototypePtr ReadProtoType(const String& parentSource)
 	{
+		// each level recurses on the C stack
+		panic_cond(++depth <= LUAI_MAXNESTING, "precompiled chunk nested too deep");
 		String source = ReadString();
 		if(source == "")
 		{
 			source = parentSource;
 		}
-		PrototypePtr proto = PrototypePtr(new Prototype());
+		std::shared_ptr<Prototype> proto(new Prototype());
 		proto->Source = source;
 		proto->LineDefined = ReadUInt();
 		proto->LastLineDefined = ReadUInt();
@@ -298,20 +314,24 @@ struct Reader
 		proto->MaxStackSize = ReadByte();
 		proto->Code = ReadCode();
 		proto->Constants = ReadConstants();
+		proto->Materialize();
 		proto->Upvalues = ReadUpvalues();
 		proto->Protos = ReadProtos(source);
 		proto->LineInfo = ReadLineInfo();
 		proto->LocVars = ReadLocVars();
 		proto->UpvalueNames = ReadUpvalueNames();
-		return proto;		
+		--depth;
+		return proto;
 	}
 };
 
-inline PrototypePtr Undump(const ByteArray& data)
+inline PrototypePtr Undump(const Byte* data, size_t size)
 {
-	Reader reader {data};
+	Reader reader(data, size);
 	reader.CheckHeader();
 	// skip Upvalue count
 	reader.ReadByte();
-	return reader.ReadProtoType("");
+	PrototypePtr proto = reader.ReadProtoType("");
+	VerifyProto(proto.get());
+	return proto;
 }
\ No newline at end of file
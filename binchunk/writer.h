@@ -0,0 +1,192 @@
+#pragma once
+#include "binary_chunk.h"
+
+// Inverse of Reader: writes a prototype as a standard Lua 5.3 binary chunk for this machine.
+// With strip the line info, local variables and upvalue names are left out.
+struct Writer
+{
+	ByteArray data;
+	bool strip;
+
+	Writer(bool _strip)
+	{
+		strip = _strip;
+	}
+
+	void WriteByte(Byte b)
+	{
+		data.push_back(b);
+	}
+
+	void _WriteBytes(const void* src, size_t byteCount)
+	{
+		const Byte* bytes = (const Byte*)src;
+		data.insert(data.end(), bytes, bytes + byteCount);
+	}
+
+	void WriteUInt(UInt32 num)
+	{
+		_WriteBytes(&num, sizeof(UInt32));
+	}
+
+	void WriteSizeT(size_t num)
+	{
+		_WriteBytes(&num, sizeof(size_t));
+	}
+
+	void WriteLuaInteger(Int64 num)
+	{
+		_WriteBytes(&num, sizeof(Int64));
+	}
+
+	void WriteLuaNumber(Float64 num)
+	{
+		_WriteBytes(&num, sizeof(Float64));
+	}
+
+	// Sizes are stored plus one, 0 stands for a missing string
+	void WriteString(const String& str, bool present = true)
+	{
+		if(!present)
+		{
+			WriteByte(0);
+			return;
+		}
+		size_t size = str.size() + 1;
+		if(size < 0xFF)
+		{
+			WriteByte((Byte)size);
+		}
+		else
+		{
+			WriteByte(0xFF);
+			WriteSizeT(size);
+		}
+		_WriteBytes(str.data(), str.size());
+	}
+
+	void _WriteUIntArray(const std::vector<UInt32>& array)
+	{
+		WriteUInt((UInt32)array.size());
+		_WriteBytes(array.data(), array.size() * sizeof(UInt32));
+	}
+
+	void WriteConstant(const Constant& constant)
+	{
+		WriteByte(constant.tag);
+		switch(constant.tag)
+		{
+			case TAG_NIL:
+				break;
+			case TAG_BOOLEAN:
+				WriteByte(constant.boolean ? 1 : 0);
+				break;
+			case TAG_INTEGER:
+				WriteLuaInteger(constant.luaInteger);
+				break;
+			case TAG_NUMBER:
+				WriteLuaNumber(constant.luaNum);
+				break;
+			case TAG_SHORT_STR:
+			case TAG_LONG_STR:
+				WriteString(constant.str);
+				break;
+		}
+	}
+
+	void WriteConstants(const std::vector<Constant>& constants)
+	{
+		WriteUInt((UInt32)constants.size());
+		for(const Constant& constant : constants)
+			WriteConstant(constant);
+	}
+
+	void WriteUpvalues(const std::vector<Upvalue>& upvalues)
+	{
+		WriteUInt((UInt32)upvalues.size());
+		for(const Upvalue& upvalue : upvalues)
+		{
+			WriteByte(upvalue.Instack);
+			WriteByte(upvalue.Idx);
+		}
+	}
+
+	void WriteProtos(const std::vector<PrototypePtr>& protos, const String& parentSource)
+	{
+		WriteUInt((UInt32)protos.size());
+		for(const PrototypePtr& proto : protos)
+			WriteProtoType(proto.get(), parentSource);
+	}
+
+	void WriteLineInfo(const std::vector<UInt32>& lineInfo)
+	{
+		if(strip)
+			WriteUInt(0);
+		else
+			_WriteUIntArray(lineInfo);
+	}
+
+	void WriteLocVars(const std::vector<LocVar>& locVars)
+	{
+		WriteUInt(strip ? 0 : (UInt32)locVars.size());
+		if(strip)
+			return;
+		for(const LocVar& locVar : locVars)
+		{
+			WriteString(locVar.VarName);
+			WriteUInt(locVar.StartPC);
+			WriteUInt(locVar.EndPC);
+		}
+	}
+
+	void WriteUpvalueNames(const std::vector<String>& names)
+	{
+		WriteUInt(strip ? 0 : (UInt32)names.size());
+		if(strip)
+			return;
+		for(const String& name : names)
+			WriteString(name);
+	}
+
+	void WriteHeader()
+	{
+		_WriteBytes(LUA_SIGNATURE, sizeof(LUA_SIGNATURE));
+		WriteByte(LUAC_VERSION);
+		WriteByte(LUAC_FORMAT);
+		_WriteBytes(LUAC_DATA, sizeof(LUAC_DATA));
+		WriteByte(CINT_SIZE);
+		WriteByte(CSIZE_SIZE);
+		WriteByte(INSTRUCTION_SIZE);
+		WriteByte(LUA_INTERGER_SIZE);
+		WriteByte(LUA_NUMBER_SIZE);
+		WriteLuaInteger(LUAC_INT);
+		WriteLuaNumber(LUAC_NUM);
+	}
+
+	void WriteProtoType(const Prototype* proto, const String& parentSource)
+	{
+		// the reader takes a missing source from the enclosing function
+		WriteString(proto->Source, !strip && !proto->Source.empty() && proto->Source != parentSource);
+		WriteUInt(proto->LineDefined);
+		WriteUInt(proto->LastLineDefined);
+		WriteByte(proto->NumParams);
+		WriteByte(proto->IsVararg);
+		WriteByte(proto->MaxStackSize);
+		_WriteUIntArray(proto->Code);
+		WriteConstants(proto->Constants);
+		WriteUpvalues(proto->Upvalues);
+		WriteProtos(proto->Protos, proto->Source.empty() ? parentSource : proto->Source);
+		WriteLineInfo(proto->LineInfo);
+		WriteLocVars(proto->LocVars);
+		WriteUpvalueNames(proto->UpvalueNames);
+	}
+};
+
+inline ByteArray Dump(const Prototype* proto, bool strip = false)
+{
+	Writer writer(strip);
+	writer.WriteHeader();
+	writer.WriteByte((Byte)proto->Upvalues.size());
+	writer.WriteProtoType(proto, "");
+	return std::move(writer.data);
+}
@@ -50,30 +50,91 @@ void FuncInfo::FreeRegs(int n)
 	}
 }
 
-void FuncInfo::AddBreakJmp(int pc)
+void FuncInfo::AddBreakJmp(int pc, int line)
 {
-	for(int i = scopeLv; i >= 0; --i)
+	bool inLoop = false;
+	for(const BlockInfo& block : blocks)
+		inLoop = inLoop || block.breakable;
+	if(!inLoop)
 	{
-		if(breaks[i] != nullptr)
+		panic(Format::FormatString("<break> at line %d not inside a loop", line).c_str());
+	}
+	gotos.push_back({"break", pc, usedRegs, line});
+}
+
+void FuncInfo::AddGotoJmp(int pc, const String& name, int line)
+{
+	gotos.push_back({name, pc, usedRegs, line});
+	_FindLabel(gotos.size() - 1);
+}
+
+// Labels only followed by other labels up to the end of their block are out of
+// the scope of the locals of the block, so a goto may skip these declarations
+void FuncInfo::AddLabel(const String& name, int line, bool atBlockEnd)
+{
+	const BlockInfo& block = blocks.back();
+	for(size_t i = block.firstLabel; i < labels.size(); ++i)
+	{
+		if(labels[i].name == name)
 		{
-			breaks[i]->emplace_back(pc);
-			return;
+			panic(Format::FormatString("label '%s' already defined on line %d", name.c_str(), labels[i].line).c_str());
 		}
 	}
-	panic("<break> at line ? not inside a loop!");
+	labels.push_back({name, PC() + 1, atBlockEnd ? block.nActVars : usedRegs, line});
+
+	// Forward gotos of the block waiting for it
+	const LabelInfo label = labels.back();
+	for(size_t g = block.firstGoto; g < gotos.size();)
+	{
+		if(gotos[g].name == name)
+			_CloseGoto(g, label);
+		else
+			++g;
+	}
 }
 
-void FuncInfo::EnterScope(bool breakable)
+// Resolves a pending goto against the labels of the current block
+bool FuncInfo::_FindLabel(size_t g)
 {
-	scopeLv += 1;
-	if(breakable)
+	for(size_t i = blocks.back().firstLabel; i < labels.size(); ++i)
 	{
-		breaks.emplace_back(BreakTableElemPtr(new BreakTableElem()));
+		if(labels[i].name == gotos[g].name)
+		{
+			// Jumping back before locals of this block, close them in case they are captured
+			if(gotos[g].nActVars > labels[i].nActVars)
+				FixA(gotos[g].pc, labels[i].nActVars + 1);
+			_CloseGoto(g, labels[i]);
+			return true;
+		}
 	}
-	else
+	return false;
+}
+
+void FuncInfo::_CloseGoto(size_t g, const LabelInfo& label)
+{
+	const LabelInfo& jmp = gotos[g];
+	if(jmp.nActVars < label.nActVars)
 	{
-		breaks.push_back(nullptr);
+		String varName;
+		for(auto& pair : locNames)
+		{
+			for(LocVarInfoPtr v = pair.second; v != nullptr; v = v->prev)
+			{
+				if(v->slot == jmp.nActVars)
+					varName = v->name;
+			}
+		}
+		panic(Format::FormatString("<goto %s> at line %d jumps into the scope of local '%s'",
+			jmp.name.c_str(), jmp.line, varName.c_str()).c_str());
 	}
+	FixSbx(jmp.pc, label.pc - jmp.pc - 1);
+	gotos.erase(gotos.begin() + g);
+}
+
+void FuncInfo::EnterScope(bool breakable)
+{
+	scopeLv += 1;
+	blocks.push_back({breakable, usedRegs, labels.size(), gotos.size()});
 }
 
 LocVarInfoPtr FuncInfo::_CurrentLocVar(const String& name)
@@ -110,6 +171,21 @@ int FuncInfo::SlotOfLocVar(const String& name)
 
 void FuncInfo::ExitScope()
 {
+	// Jumps leaving the scope close its captured locals
+	int a = GetJmpArgA();
+	BlockInfo block = blocks.back();
+	blocks.pop_back();
+	labels.resize(block.firstLabel);
+	for(size_t g = block.firstGoto; g < gotos.size(); ++g)
+	{
+		if(gotos[g].nActVars > block.nActVars)
+		{
+			if(a > 0)
+				FixA(gotos[g].pc, a);
+			gotos[g].nActVars = block.nActVars;
+		}
+	}
+
 	scopeLv -= 1;
 
 	std::vector<LocVarInfoPtr> locVars;
@@ -127,17 +203,27 @@ void FuncInfo::ExitScope()
 		}
 	}
 
-	panic_cond(breaks.size() > 0, "break table is empty");
-	BreakTableElemPtr pendingBreakJmps = breaks[breaks.size() - 1];
-	if(pendingBreakJmps)
+	if(block.breakable)
+	{
+		const LabelInfo label = {"break", PC() + 1, block.nActVars, 0};
+		for(size_t g = block.firstGoto; g < gotos.size();)
+		{
+			if(gotos[g].name == label.name)
+				_CloseGoto(g, label);
+			else
+				++g;
+		}
+	}
+
+	// The rest may find their label in the enclosing block
+	for(size_t g = block.firstGoto; g < gotos.size();)
 	{
-		int a = GetJmpArgA();
-		for(int pc : *pendingBreakJmps)
+		if(blocks.empty())
 		{
-			int sBx = PC() - pc;
-			int i = (sBx + MAXARG_sBX) << 14 | a << 6 | OP_JMP;
-			insts[pc] = (UInt32)i;
+			panic(Format::FormatString("no visible label '%s' for <goto> at line %d", gotos[g].name.c_str(), gotos[g].line).c_str());
 		}
+		if(!_FindLabel(g))
+			++g;
 	}
 }
 
@@ -229,14 +315,38 @@ void FuncInfo::FixSbx(int pc, int sBx)
 	insts[pc] = i;
 }
 
-void CGBlock(FuncInfoPtr fi, BlockPtr node)
+void FuncInfo::FixA(int pc, int a)
+{
+	UInt32 i = insts[pc];
+	// clear A
+	i = i & ~(UInt32(0xFF) << 6);
+	// reset A
+	i = i | UInt32(a) << 6;
+	insts[pc] = i;
+}
+
+// untilFollows: the block of a repeat, its locals are still in scope in the until expression
+void CGBlock(FuncInfoPtr fi, BlockPtr node, bool untilFollows)
 {
-	for(StatPtr stat : node->Stats)
+	// Labels from here on are at the end of the block
+	int nStats = (int)node->Stats.size();
+	int blockEnd = nStats;
+	if(!node->HasReturn && !untilFollows)
 	{
-		CGStat(fi, stat);
+		while(blockEnd > 0 && node->Stats[blockEnd - 1]->Kind == STAT_LABEL)
+			--blockEnd;
 	}
 
-	if(node->RetExps.size())
+	for(int i = 0; i < nStats; ++i)
+	{
+		StatPtr stat = node->Stats[i];
+		if(stat->Kind == STAT_LABEL)
+			CGLabelStat(fi, static_cast<LabelStat*>(stat), i >= blockEnd);
+		else
+			CGStat(fi, stat);
+	}
+
+	if(node->HasReturn)
 	{
 		CGRetStat(fi, node->RetExps);
 	}
@@ -335,85 +445,122 @@ int FuncInfo::GetJmpArgA()
 
 void CGStat(FuncInfoPtr fi, StatPtr node)
 {
-	if(node->IsA<FuncCallStat>())
-		CGFuncCall(fi, node);
-	else if(node->IsA<BreakStat>())
-		CGBreakStat(fi, node);
-	else if(node->IsA<DoStat>())
-		CGDoStat(fi, node);
-	else if(node->IsA<RepeatStat>())
-		CGRepeatStat(fi, node);
-	else if(node->IsA<WhileStat>())
-		CGWhileStat(fi, node);
-	else if(node->IsA<IfStat>())
-		CGIfStat(fi, node);
-	else if(node->IsA<ForNumStat>())
-		CGForNumStat(fi, node);
-	else if(node->IsA<ForInStat>())
-		CGForInStat(fi, node);
-	else if(node->IsA<AssignStat>())
-		CGAssignStat(fi, node);
-	else if(node->IsA<LocalVarDeclStat>())
-		CGLocalVarDeclStat(fi, node);
-	else if(node->IsA<LocalFuncDefStat>())
-		CGLocalFuncDefStat(fi, node);
-	else
-		panic("not support right now");
+	switch(node->Kind)
+	{
+		case STAT_FUNC_CALL: CGFuncCall(fi, static_cast<FuncCallStat*>(node)); break;
+		case STAT_BREAK: CGBreakStat(fi, static_cast<BreakStat*>(node)); break;
+		case STAT_LABEL: CGLabelStat(fi, static_cast<LabelStat*>(node), false); break;
+		case STAT_GOTO: CGGotoStat(fi, static_cast<GotoStat*>(node)); break;
+		case STAT_DO: CGDoStat(fi, static_cast<DoStat*>(node)); break;
+		case STAT_REPEAT: CGRepeatStat(fi, static_cast<RepeatStat*>(node)); break;
+		case STAT_WHILE: CGWhileStat(fi, static_cast<WhileStat*>(node)); break;
+		case STAT_IF: CGIfStat(fi, static_cast<IfStat*>(node)); break;
+		case STAT_FOR_NUM: CGForNumStat(fi, static_cast<ForNumStat*>(node)); break;
+		case STAT_FOR_IN: CGForInStat(fi, static_cast<ForInStat*>(node)); break;
+		case STAT_ASSIGN: CGAssignStat(fi, static_cast<AssignStat*>(node)); break;
+		case STAT_LOCAL_VAR_DECL: CGLocalVarDeclStat(fi, static_cast<LocalVarDeclStat*>(node)); break;
+		case STAT_LOCAL_FUNC_DEF: CGLocalFuncDefStat(fi, static_cast<LocalFuncDefStat*>(node)); break;
+		default: panic("not support right now"); break;
+	}
 }
 
-void CGLocalFuncDefStat(FuncInfoPtr fi, StatPtr node)
+void CGLocalFuncDefStat(FuncInfoPtr fi, LocalFuncDefStat* stat)
 {
-	LocalFuncDefStat* stat = node->Cast<LocalFuncDefStat>();
 	int r = fi->AddLocVar(stat->Name);
-	CGFuncDefExp(fi, stat->Exp, r);
+	CGFuncDefExp(fi, static_cast<FuncDefExp*>(stat->Exp), r);
 }
 
-void CGFuncCall(FuncInfoPtr fi, StatPtr node)
+void CGFuncCall(FuncInfoPtr fi, FuncCallStat* stat)
 {
-	FuncCallStat* stat = node->Cast<FuncCallStat>();
-	ExpPtr exp = Exp::New<FuncCallExp>();
-
-	exp->Cast<FuncCallExp>()->Line = stat->Line;
-	exp->Cast<FuncCallExp>()->LastLine = stat->LastLine;
-	exp->Cast<FuncCallExp>()->PrefixExp = stat->PrefixExp;
-	exp->Cast<FuncCallExp>()->NameExp = stat->NameExp;
-	exp->Cast<FuncCallExp>()->Args = stat->Args;
+	// temporary nodes of the code generator live on the stack
+	FuncCallExp exp;
+	exp.Line = stat->Line;
+	exp.LastLine = stat->LastLine;
+	exp.PrefixExp = stat->PrefixExp;
+	exp.NameExp = stat->NameExp;
+	exp.Args = stat->Args;
 
 	int r = fi->AllocReg();
-	CGFuncCallExp(fi, exp, r, 0);
+	CGFuncCallExp(fi, &exp, r, 0);
 	fi->FreeReg();
 }
 
-void CGBreakStat(FuncInfoPtr fi, StatPtr node)
+void CGBreakStat(FuncInfoPtr fi, BreakStat* stat)
 {
 	// Add the break instruction first,
 	// and then backpatch it when exiting the scope
 	int pc = fi->EmitJmp(0, 0);
-	fi->AddBreakJmp(pc);
+	fi->AddBreakJmp(pc, stat->Line);
 }
 
-void CGDoStat(FuncInfoPtr fi, StatPtr node)
+void CGLabelStat(FuncInfoPtr fi, LabelStat* stat, bool atBlockEnd)
+{
+	fi->AddLabel(stat->Name, stat->Line, atBlockEnd);
+}
+
+void CGGotoStat(FuncInfoPtr fi, GotoStat* stat)
+{
+	// A backward goto is patched right away, a forward one once its label shows up
+	int pc = fi->EmitJmp(0, 0);
+	fi->AddGotoJmp(pc, stat->Name, stat->Line);
+}
+
+void CGDoStat(FuncInfoPtr fi, DoStat* stat)
 {
-	DoStat* stat = node->Cast<DoStat>();
 	fi->EnterScope(false);
 	CGBlock(fi, stat->Block);
 	fi->CloseOpenUpvals();
 	fi->ExitScope();
 }
 
-void CGWhileStat(FuncInfoPtr fi, StatPtr node)
+// Emits a jump taken when exp is false, the block that follows runs when it is true.
+// Returns the pc of the jump to backpatch. Comparisons are tested directly
+// instead of producing a boolean to TEST.
+int CGJmpIfFalse(FuncInfoPtr fi, ExpPtr exp, int jmpA)
 {
-	WhileStat* stat = node->Cast<WhileStat>();
-	int pcBeforeExp = fi->PC();
+	if(exp->Kind == EXP_BINOP)
+	{
+		BinopExp* binop = static_cast<BinopExp*>(exp);
+		int opcode = -1;
+		// an EQ, LT or LE skips the jump when its result differs from A
+		int a = 0;
+		bool swap = false;
+		switch(binop->Op)
+		{
+			case TOKEN_OP_EQ: opcode = OP_EQ; break;
+			case TOKEN_OP_NE: opcode = OP_EQ; a = 1; break;
+			case TOKEN_OP_LT: opcode = OP_LT; break;
+			case TOKEN_OP_GT: opcode = OP_LT; swap = true; break;
+			case TOKEN_OP_LE: opcode = OP_LE; break;
+			case TOKEN_OP_GE: opcode = OP_LE; swap = true; break;
+		}
+		if(opcode >= 0)
+		{
+			int allocated = 0;
+			int b = ExpToOpArg(fi, binop->Exp1, ARG_RK, allocated);
+			int c = ExpToOpArg(fi, binop->Exp2, ARG_RK, allocated);
+			if(swap)
+				std::swap(b, c);
+			fi->EmitABC(opcode, a, b, c);
+			fi->FreeRegs(allocated);
+			return fi->EmitJmp(jmpA, 0);
+		}
+	}
 
 	int r = fi->AllocReg();
-	CGExp(fi, stat->Exp, r, 1);
+	CGExp(fi, exp, r, 1);
 	fi->FreeReg();
-
 	// If the r result is true, then skip the next instruction
 	fi->EmitTest(r, 0);
+	return fi->EmitJmp(jmpA, 0);
+}
+
+void CGWhileStat(FuncInfoPtr fi, WhileStat* stat)
+{
+	int pcBeforeExp = fi->PC();
+
 	// The jmp instruction will be backpatched later
-	int pcJmpToEnd = fi->EmitJmp(0, 0);
+	int pcJmpToEnd = CGJmpIfFalse(fi, stat->Exp, 0);
 
 	fi->EnterScope(true);
 	CGBlock(fi, stat->Block);
@@ -425,29 +572,22 @@ void CGWhileStat(FuncInfoPtr fi, StatPtr node)
 	fi->FixSbx(pcJmpToEnd, fi->PC() - pcJmpToEnd);
 }
 
-void CGRepeatStat(FuncInfoPtr fi, StatPtr node)
+void CGRepeatStat(FuncInfoPtr fi, RepeatStat* stat)
 {
-	RepeatStat* stat = node->Cast<RepeatStat>();	
 	fi->EnterScope(true);
 
 	int pcBeforeBlock = fi->PC();
-	CGBlock(fi, stat->Block);
-
-	int r = fi->AllocReg();
-	CGExp(fi, stat->Exp, r, 1);
-	fi->FreeReg();
+	CGBlock(fi, stat->Block, true);
 
-	// If the r result is true, then skip the next instruction
-	fi->EmitTest(r, 0);
-	fi->EmitJmp(fi->GetJmpArgA(), pcBeforeBlock - fi->PC() - 1);
+	int pcJmpToBlock = CGJmpIfFalse(fi, stat->Exp, fi->GetJmpArgA());
+	fi->FixSbx(pcJmpToBlock, pcBeforeBlock - pcJmpToBlock);
 	fi->CloseOpenUpvals();
 
 	fi->ExitScope();
 }
 
-void CGIfStat(FuncInfoPtr fi, StatPtr node)
+void CGIfStat(FuncInfoPtr fi, IfStat* stat)
 {
-	IfStat* stat = node->Cast<IfStat>();
 
 	std::vector<int> pcJmpToEnds;
 	pcJmpToEnds.resize(stat->Exps.size());
@@ -464,11 +604,11 @@ void CGIfStat(FuncInfoPtr fi, StatPtr node)
 			fi->FixSbx(pcJmpToNextExp, fi->PC() - pcJmpToNextExp);
 		}
 
-		int r = fi->AllocReg(); CGExp(fi, exp, r, 1); fi->FreeReg();
-		fi->EmitTest(r, 0); pcJmpToNextExp = fi->EmitJmp(0, 0);
+		pcJmpToNextExp = CGJmpIfFalse(fi, exp, 0);
 
 		fi->EnterScope(false);
 		CGBlock(fi, stat->Blocks[i]);
+		fi->CloseOpenUpvals();
 		fi->ExitScope();
 
 		if(i  < (int)(stat->Exps.size() - 1))
@@ -485,15 +625,14 @@ void CGIfStat(FuncInfoPtr fi, StatPtr node)
 	}
 }
 
-void CGForNumStat(FuncInfoPtr fi, StatPtr node)
+void CGForNumStat(FuncInfoPtr fi, ForNumStat* stat)
 {
-	ForNumStat* stat = node->Cast<ForNumStat>();	
 	fi->EnterScope(true);
 
-	StatPtr tempDecl = Stat::New<LocalVarDeclStat>();
-	tempDecl->Cast<LocalVarDeclStat>()->NameList = {"(for index)", "(for limit)", "(for step)"};
-	tempDecl->Cast<LocalVarDeclStat>()->ExpList = {stat->InitExp, stat->LimitExp, stat->StepExp};
-	CGLocalVarDeclStat(fi, tempDecl);
+	LocalVarDeclStat tempDecl;
+	tempDecl.NameList = {"(for index)", "(for limit)", "(for step)"};
+	tempDecl.ExpList = {stat->InitExp, stat->LimitExp, stat->StepExp};
+	CGLocalVarDeclStat(fi, &tempDecl);
 
 	fi->AddLocVar(stat->VarName);
 	int a = fi->usedRegs - 4;
@@ -509,15 +648,14 @@ void CGForNumStat(FuncInfoPtr fi, StatPtr node)
 	fi->ExitScope();
 }
 
-void CGForInStat(FuncInfoPtr fi, StatPtr node)
+void CGForInStat(FuncInfoPtr fi, ForInStat* stat)
 {
-	ForInStat* stat = node->Cast<ForInStat>();	
 	fi->EnterScope(true);
 
-	StatPtr tempDecl = Stat::New<LocalVarDeclStat>();
-	tempDecl->Cast<LocalVarDeclStat>()->NameList = {"(for generator)", "(for state)", "(for control)"};
-	tempDecl->Cast<LocalVarDeclStat>()->ExpList = stat->ExpList;
-	CGLocalVarDeclStat(fi, tempDecl);
+	LocalVarDeclStat tempDecl;
+	tempDecl.NameList = {"(for generator)", "(for state)", "(for control)"};
+	tempDecl.ExpList = stat->ExpList;
+	CGLocalVarDeclStat(fi, &tempDecl);
 
 	for(const String& name : stat->NameList)
 	{
@@ -537,9 +675,8 @@ void CGForInStat(FuncInfoPtr fi, StatPtr node)
 	fi->ExitScope();
 }
 
-void CGLocalVarDeclStat(FuncInfoPtr fi, StatPtr node)
+void CGLocalVarDeclStat(FuncInfoPtr fi, LocalVarDeclStat* stat)
 {
-	LocalVarDeclStat* stat = node->Cast<LocalVarDeclStat>();
 	int nExps = (int)stat->ExpList.size();
 	int nNames = (int)stat->NameList.size();
 
@@ -604,9 +741,8 @@ void CGLocalVarDeclStat(FuncInfoPtr fi, StatPtr node)
 	}
 }
 
-void CGAssignStat(FuncInfoPtr fi, StatPtr node)
+void CGAssignStat(FuncInfoPtr fi, AssignStat* stat)
 {
-	AssignStat* stat = node->Cast<AssignStat>();
 
 	int nExps = (int)stat->ExpList.size();
 	int nVars = (int)stat->VarList.size();
@@ -614,17 +750,19 @@ void CGAssignStat(FuncInfoPtr fi, StatPtr node)
 	std::vector<int> tRegs; tRegs.resize(nVars);
 	std::vector<int> kRegs; kRegs.resize(nVars);
 	std::vector<int> vRegs; vRegs.resize(nVars);
+	// With several targets an earlier local may be assigned before a later table is stored to,
+	// so locals are only used in place for a single one
+	int argKinds = nVars == 1 ? ARG_RK : ARG_CONST;
+	int allocated = 0;
 
 	for(int i = 0; i < nVars; ++i)
 	{
 		ExpPtr exp = stat->VarList[i];
-		if(exp->IsA<TableAccessExp>())
+		if(exp->Kind == EXP_TABLE_ACCESS)
 		{
-			TableAccessExp* taExp = exp->Cast<TableAccessExp>();
-			tRegs[i] = fi->AllocReg();
-			CGExp(fi, taExp->PrefixExp, tRegs[i], 1);
-			kRegs[i] = fi->AllocReg();
-			CGExp(fi, taExp->KeyExp, kRegs[i], 1);
+			TableAccessExp* taExp = static_cast<TableAccessExp*>(exp);
+			tRegs[i] = ExpToOpArg(fi, taExp->PrefixExp, argKinds & ARG_LOCAL, allocated);
+			kRegs[i] = ExpToOpArg(fi, taExp->KeyExp, argKinds, allocated);
 		}
 	}
 	// Although there is no register allocated,
@@ -634,7 +772,15 @@ void CGAssignStat(FuncInfoPtr fi, StatPtr node)
 		vRegs[i] = fi->usedRegs + i;
 	}
 
-	if(nExps >= nVars)
+	// a single value stored into a table can be an RK operand too
+	bool storesToTable = nVars == 1 && (stat->VarList[0]->Kind == EXP_TABLE_ACCESS ||
+		(fi->SlotOfLocVar(static_cast<NameExp*>(stat->VarList[0])->Name) < 0 &&
+		fi->IndexOfUpval(static_cast<NameExp*>(stat->VarList[0])->Name) < 0));
+	if(nExps == 1 && storesToTable)
+	{
+		vRegs[0] = ExpToOpArg(fi, stat->ExpList[0], ARG_RK, allocated);
+	}
+	else if(nExps >= nVars)
 	{
 		for(int i = 0; i < nExps; ++i)
 		{
@@ -681,9 +827,9 @@ void CGAssignStat(FuncInfoPtr fi, StatPtr node)
 	for(int i = 0; i < nVars; ++i)
 	{
 		ExpPtr exp = stat->VarList[i];
-		if(exp->IsA<NameExp>())
+		if(exp->Kind == EXP_NAME)
 		{
-			NameExp* nameExp = exp->Cast<NameExp>();
+			NameExp* nameExp = static_cast<NameExp*>(exp);
 			const String& varName = nameExp->Name;
 			int a = fi->SlotOfLocVar(varName);
 			if(a >= 0)
@@ -721,47 +867,66 @@ void CGAssignStat(FuncInfoPtr fi, StatPtr node)
 	fi->usedRegs = oldRegs;
 }
 
+// Literals become constants and locals stay in their register when argKinds allows it,
+// anything else is evaluated into a new register counted in allocated for the caller to free
+int ExpToOpArg(FuncInfoPtr fi, ExpPtr exp, int argKinds, int& allocated)
+{
+	if(argKinds & ARG_CONST)
+	{
+		int idx = -1;
+		switch(exp->Kind)
+		{
+			case EXP_NIL: idx = fi->IndexOfConstant(LuaValue::Nil); break;
+			case EXP_FALSE: idx = fi->IndexOfConstant(LuaValue(false)); break;
+			case EXP_TRUE: idx = fi->IndexOfConstant(LuaValue(true)); break;
+			case EXP_INTEGER: idx = fi->IndexOfConstant(LuaValue(static_cast<IntegerExp*>(exp)->Val)); break;
+			case EXP_FLOAT: idx = fi->IndexOfConstant(LuaValue(static_cast<FloatExp*>(exp)->Val)); break;
+			case EXP_STRING: idx = fi->IndexOfConstant(LuaValue(static_cast<StringExp*>(exp)->Val)); break;
+			default: break;
+		}
+		// RK only reaches the first 256 constants
+		if(idx >= 0 && idx <= 0xFF)
+			return 0x100 + idx;
+	}
+	if((argKinds & ARG_LOCAL) && exp->Kind == EXP_NAME)
+	{
+		int r = fi->SlotOfLocVar(static_cast<NameExp*>(exp)->Name);
+		if(r >= 0)
+			return r;
+	}
+	int a = fi->AllocReg();
+	CGExp(fi, exp, a, 1);
+	++allocated;
+	return a;
+}
+
 // Put at most n values ​​of expression on register a
 void CGExp(FuncInfoPtr fi, ExpPtr node, int a, int n)
 {
-	if(node->IsA<NilExp>())
-		fi->EmitLoadNil(a, n);
-	else if(node->IsA<FalseExp>())
-		fi->EmitLoadBool(a, 0, 0);
-	else if(node->IsA<TrueExp>())
-		fi->EmitLoadBool(a, 1, 0);
-	else if(node->IsA<IntegerExp>())
-		fi->EmitLoadK(a, LuaValue(node->Cast<IntegerExp>()->Val));
-	else if(node->IsA<FloatExp>())
-		fi->EmitLoadK(a, LuaValue(node->Cast<FloatExp>()->Val));
-	else if(node->IsA<StringExp>())
-		fi->EmitLoadK(a, LuaValue(node->Cast<StringExp>()->Val));
-	else if(node->IsA<ParensExp>())
-		CGExp(fi, node->Cast<ParensExp>()->Exp, a, 1);
-	else if(node->IsA<VarargExp>())
-		CGVarargExp(fi, node, a, n);
-	else if(node->IsA<FuncDefExp>())
-		CGFuncDefExp(fi, node, a);
-	else if(node->IsA<TableConstructorExp>())
-		CGTableConstructorExp(fi, node, a);
-	else if(node->IsA<UnopExp>())
-		CGUnopExp(fi, node, a);
-	else if(node->IsA<BinopExp>())
-		CGBinopExp(fi, node, a);
-	else if(node->IsA<ConcatExp>())
-		CGConcatExp(fi, node, a);
-	else if(node->IsA<NameExp>())
-		CGNameExp(fi, node, a);
-	else if(node->IsA<TableAccessExp>())
-		CGTableAceessExp(fi, node, a);
-	else if(node->IsA<FuncCallExp>())
-		CGFuncCallExp(fi, node, a, n);
-	else
-		panic("should never reach");
+	switch(node->Kind)
+	{
+		case EXP_NIL: fi->EmitLoadNil(a, n); break;
+		case EXP_FALSE: fi->EmitLoadBool(a, 0, 0); break;
+		case EXP_TRUE: fi->EmitLoadBool(a, 1, 0); break;
+		case EXP_INTEGER: fi->EmitLoadK(a, LuaValue(static_cast<IntegerExp*>(node)->Val)); break;
+		case EXP_FLOAT: fi->EmitLoadK(a, LuaValue(static_cast<FloatExp*>(node)->Val)); break;
+		case EXP_STRING: fi->EmitLoadK(a, LuaValue(static_cast<StringExp*>(node)->Val)); break;
+		case EXP_PARENS: CGExp(fi, static_cast<ParensExp*>(node)->Exp, a, 1); break;
+		case EXP_VARARG: CGVarargExp(fi, a, n); break;
+		case EXP_FUNC_DEF: CGFuncDefExp(fi, static_cast<FuncDefExp*>(node), a); break;
+		case EXP_TABLE_CONSTRUCTOR: CGTableConstructorExp(fi, static_cast<TableConstructorExp*>(node), a); break;
+		case EXP_UNOP: CGUnopExp(fi, static_cast<UnopExp*>(node), a); break;
+		case EXP_BINOP: CGBinopExp(fi, static_cast<BinopExp*>(node), a); break;
+		case EXP_CONCAT: CGConcatExp(fi, static_cast<ConcatExp*>(node), a); break;
+		case EXP_NAME: CGNameExp(fi, static_cast<NameExp*>(node), a); break;
+		case EXP_TABLE_ACCESS: CGTableAceessExp(fi, static_cast<TableAccessExp*>(node), a); break;
+		case EXP_FUNC_CALL: CGFuncCallExp(fi, static_cast<FuncCallExp*>(node), a, n); break;
+		default: panic("should never reach"); break;
+	}
 }
 
 // n pass >=0 means read n parameters, n pass -1 means read all parameters
-void CGVarargExp(FuncInfoPtr fi, ExpPtr node, int a, int n)
+void CGVarargExp(FuncInfoPtr fi, int a, int n)
 {
 	if(!fi->isVararg)
 	{
@@ -770,9 +935,8 @@ void CGVarargExp(FuncInfoPtr fi, ExpPtr node, int a, int n)
 	fi->EmitVararg(a, n);
 }
 
-void CGFuncDefExp(FuncInfoPtr fi, ExpPtr node, int a)
+void CGFuncDefExp(FuncInfoPtr fi, FuncDefExp* exp, int a)
 {
-	FuncDefExp* exp = node->Cast<FuncDefExp>();
 	FuncInfoPtr subFI = NewFuncInfo(fi, exp);
 	fi->subFuncs.emplace_back(subFI);
 
@@ -790,9 +954,8 @@ void CGFuncDefExp(FuncInfoPtr fi, ExpPtr node, int a)
 	fi->EmitClosure(a, bx);
 }
 
-void CGTableConstructorExp(FuncInfoPtr fi, ExpPtr node, int a)
+void CGTableConstructorExp(FuncInfoPtr fi, TableConstructorExp* exp, int a)
 {
-	TableConstructorExp* exp = node->Cast<TableConstructorExp>();
 	int nArr = 0;
 	for(ExpPtr keyExp : exp->KeyExps)
 	{
@@ -852,18 +1015,16 @@ void CGTableConstructorExp(FuncInfoPtr fi, ExpPtr node, int a)
 	}
 }
 
-void CGUnopExp(FuncInfoPtr fi, ExpPtr node, int a)
+void CGUnopExp(FuncInfoPtr fi, UnopExp* exp, int a)
 {
-	UnopExp* exp = node->Cast<UnopExp>();
 	int b = fi->AllocReg();
 	CGExp(fi, exp->Exp, b, 1);
 	fi->EmitUnaryOp(exp->Op, a, b);
 	fi->FreeReg();
 }
 
-void CGBinopExp(FuncInfoPtr fi, ExpPtr node, int a)
+void CGBinopExp(FuncInfoPtr fi, BinopExp* exp, int a)
 {
-	BinopExp* exp = node->Cast<BinopExp>();
 	switch (exp->Op)
 	{
 		case TOKEN_OP_AND:
@@ -897,19 +1058,17 @@ void CGBinopExp(FuncInfoPtr fi, ExpPtr node, int a)
 		}
 		default:
 		{
-			int b = fi->AllocReg();
-			CGExp(fi, exp->Exp1, b, 1);
-			int c = fi->AllocReg();
-			CGExp(fi, exp->Exp2, c, 1);
+			int allocated = 0;
+			int b = ExpToOpArg(fi, exp->Exp1, ARG_RK, allocated);
+			int c = ExpToOpArg(fi, exp->Exp2, ARG_RK, allocated);
 			fi->EmitBinaryOp(exp->Op, a, b, c);
-			fi->FreeRegs(2);
+			fi->FreeRegs(allocated);
 		}
 	}
 }
 
-void CGConcatExp(FuncInfoPtr fi, ExpPtr node, int a)
+void CGConcatExp(FuncInfoPtr fi, ConcatExp* exp, int a)
 {
-	ConcatExp* exp = node->Cast<ConcatExp>();
 	for(ExpPtr subExp : exp->Exps)
 	{
 		int _a = fi->AllocReg();
@@ -922,9 +1081,8 @@ void CGConcatExp(FuncInfoPtr fi, ExpPtr node, int a)
 	fi->EmitABC(OP_CONCAT, a, b, c);
 }
 
-void CGNameExp(FuncInfoPtr fi, ExpPtr node, int a)
+void CGNameExp(FuncInfoPtr fi, NameExp* exp, int a)
 {
-	NameExp* exp = node->Cast<NameExp>();
 	int r = fi->SlotOfLocVar(exp->Name);
 	if(r >= 0)
 	{
@@ -940,33 +1098,48 @@ void CGNameExp(FuncInfoPtr fi, ExpPtr node, int a)
 		}
 		else
 		{
-			ExpPtr tabExp = Exp::New<TableAccessExp>();
-			ExpPtr prefixExp = Exp::New<NameExp>();
-			ExpPtr keyExp = Exp::New<StringExp>();
+			// global, _ENV.Name
+			TableAccessExp tabExp;
+			NameExp prefixExp;
+			StringExp keyExp;
 
-			prefixExp->Cast<NameExp>()->Line = 0;
-			prefixExp->Cast<NameExp>()->Name = "_ENV";
+			prefixExp.Line = 0;
+			prefixExp.Name = "_ENV";
 
-			keyExp->Cast<StringExp>()->Line = 0;
-			keyExp->Cast<StringExp>()->Val = exp->Name;
+			keyExp.Line = 0;
+			keyExp.Val = exp->Name;
 
-			tabExp->Cast<TableAccessExp>()->PrefixExp = prefixExp;
-			tabExp->Cast<TableAccessExp>()->KeyExp = keyExp;
+			tabExp.PrefixExp = &prefixExp;
+			tabExp.KeyExp = &keyExp;
 
-			CGTableAceessExp(fi, tabExp, a);
+			CGTableAceessExp(fi, &tabExp, a);
 		}
 	}
 }
 
-void CGTableAceessExp(FuncInfoPtr fi, ExpPtr node, int a)
+void CGTableAceessExp(FuncInfoPtr fi, TableAccessExp* exp, int a)
 {
-	TableAccessExp* exp = node->Cast<TableAccessExp>();
-	int b = fi->AllocReg();
-	CGExp(fi, exp->PrefixExp, b, 1);
-	int c = fi->AllocReg();
-	CGExp(fi, exp->KeyExp, c, 1);
+	int allocated = 0;
+	// a table in an upvalue (globals through _ENV) is indexed in place
+	if(exp->PrefixExp->Kind == EXP_NAME)
+	{
+		const String& name = static_cast<NameExp*>(exp->PrefixExp)->Name;
+		if(fi->SlotOfLocVar(name) < 0)
+		{
+			int idx = fi->IndexOfUpval(name);
+			if(idx >= 0)
+			{
+				int c = ExpToOpArg(fi, exp->KeyExp, ARG_RK, allocated);
+				fi->EmitGetTabUp(a, idx, c);
+				fi->FreeRegs(allocated);
+				return;
+			}
+		}
+	}
+	int b = ExpToOpArg(fi, exp->PrefixExp, ARG_LOCAL, allocated);
+	int c = ExpToOpArg(fi, exp->KeyExp, ARG_RK, allocated);
 	fi->EmitGetTable(a, b, c);
-	fi->FreeRegs(2);
+	fi->FreeRegs(allocated);
 }
 
 int PrepFuncCall(FuncInfoPtr fi, FuncCallExp* node, int a)
@@ -981,7 +1154,7 @@ int PrepFuncCall(FuncInfoPtr fi, FuncCallExp* node, int a)
 
 	if(node->NameExp != nullptr)
 	{
-		StringExp* nameExp = node->NameExp->Cast<StringExp>();
+		StringExp* nameExp = static_cast<StringExp*>(node->NameExp);
 		int c = 0x100 + fi->IndexOfConstant(LuaValue(nameExp->Val));
 		fi->AllocReg();
 		fi->EmitSelf(a, a, c);
@@ -1015,9 +1188,9 @@ int PrepFuncCall(FuncInfoPtr fi, FuncCallExp* node, int a)
 	return nArgs;
 }
 
-void CGFuncCallExp(FuncInfoPtr fi, ExpPtr node, int a, int n)
+void CGFuncCallExp(FuncInfoPtr fi, FuncCallExp* exp, int a, int n)
 {
-	int nArgs = PrepFuncCall(fi, node->Cast<FuncCallExp>(), a);
+	int nArgs = PrepFuncCall(fi, exp, a);
 	fi->EmitCall(a, nArgs, n);
 }
 
@@ -1301,6 +1474,8 @@ FuncInfoPtr NewFuncInfo(FuncInfoPtr parent, FuncDefExp* fd)
 	funcInfo->parent = parent;
 	funcInfo->isVararg = fd->IsVararg;
 	funcInfo->numParams = (int)fd->ParList.size();
+	funcInfo->line = fd->Line;
+	funcInfo->lastLine = fd->LastLine;
 	return funcInfo;
 }
 
@@ -1335,11 +1510,11 @@ Constant GetConstant(const LuaValue& val)
 	}
 	else if(val.IsString())
 	{
-		if(val.str.length() > 253)
+		if(val.AsString().length() > 253)
 			constant.tag = TAG_LONG_STR;
 		else
 			constant.tag = TAG_SHORT_STR;
-		constant.str = val.str;
+		constant.str = val.AsString();
 	}
 	else
 	{
@@ -1378,13 +1553,16 @@ std::vector<Upvalue> GetUpvalues(FuncInfoPtr fi)
 	return upvals;
 }
 
-PrototypePtr ToProto(FuncInfoPtr fi)
+std::shared_ptr<Prototype> ToProto(FuncInfoPtr fi)
 {
-	PrototypePtr proto = PrototypePtr(new Prototype());
+	std::shared_ptr<Prototype> proto(new Prototype());
+	proto->LineDefined = (UInt32)fi->line;
+	proto->LastLineDefined = (UInt32)fi->lastLine;
 	proto->NumParams = (Byte)fi->numParams;
 	proto->MaxStackSize = (Byte)fi->maxRegs;
 	proto->Code = fi->insts;
 	proto->Constants = GetConstants(fi);
+	proto->Materialize();
 	proto->Upvalues = GetUpvalues(fi);
 	proto->Protos = ToProtos(fi->subFuncs);
 	proto->LineInfo = {};// debug
@@ -1394,19 +1572,24 @@ PrototypePtr ToProto(FuncInfoPtr fi)
 	return proto;
 }
 
-PrototypePtr GenProto(BlockPtr chunk)
+PrototypePtr GenProto(BlockPtr chunk, const String& chunkName)
 {
-	ExpPtr exp = Exp::New<FuncDefExp>();
-	FuncDefExp* fd = exp->Cast<FuncDefExp>();
+	FuncDefExp exp;
+	FuncDefExp* fd = &exp;
 	// Fake main function which contains _ENV
 	// 	function __main(...)
 	// 		_ENV
 	// 		chunk -> main()
 	// end
+	fd->Line = 0;
+	fd->LastLine = 0;
 	fd->IsVararg = true;
 	fd->Block = chunk;
 	FuncInfoPtr fi = NewFuncInfo(nullptr, fd);
 	fi->AddLocVar("_ENV");
-	CGFuncDefExp(fi, exp, 0);
-	return ToProto(fi->subFuncs[0]);
+	CGFuncDefExp(fi, fd, 0);
+	std::shared_ptr<Prototype> proto = ToProto(fi->subFuncs[0]);
+	// nested functions share the source of the main one
+	proto->Source = chunkName;
+	return proto;
 }
\ No newline at end of file
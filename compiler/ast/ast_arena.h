@@ -0,0 +1,83 @@
+#pragma once
+#include "public.h"
+#include <new>
+#include <type_traits>
+
+// Bump allocator for the syntax tree of one compilation. Nodes are never freed one by one,
+// the arena releases its blocks at once (running the destructors of nodes owning strings or arrays).
+// An arena is the current one from its construction to its destruction, Stat::New and Exp::New use it.
+struct AstArena
+{
+	static const size_t BLOCK_SIZE = 64 * 1024;
+
+	struct Dtor
+	{
+		void* obj;
+		void(*destroy)(void*);
+	};
+
+	std::vector<char*> blocks;
+	size_t used;
+	std::vector<Dtor> dtors;
+	AstArena* prev;
+
+	AstArena()
+	{
+		used = BLOCK_SIZE;
+		prev = _Current();
+		_Current() = this;
+	}
+
+	~AstArena()
+	{
+		for(size_t i = dtors.size(); i > 0; --i)
+			dtors[i - 1].destroy(dtors[i - 1].obj);
+		for(char* block : blocks)
+			delete[] block;
+		_Current() = prev;
+	}
+
+	AstArena(const AstArena&) = delete;
+	AstArena& operator=(const AstArena&) = delete;
+
+	template<typename T>
+	T* New()
+	{
+		T* obj = new(_Alloc(sizeof(T), alignof(T))) T();
+		if(!std::is_trivially_destructible<T>::value)
+			dtors.push_back({obj, &_Destroy<T>});
+		return obj;
+	}
+
+	static AstArena* Current()
+	{
+		panic_cond(_Current() != nullptr, "no AST arena, compile inside an AstArena scope");
+		return _Current();
+	}
+
+	static AstArena*& _Current()
+	{
+		static AstArena* current = nullptr;
+		return current;
+	}
+
+	void* _Alloc(size_t size, size_t align)
+	{
+		used = (used + align - 1) & ~(align - 1);
+		if(used + size > BLOCK_SIZE)
+		{
+			panic_cond(size <= BLOCK_SIZE, "AST node too large");
+			blocks.push_back(new char[BLOCK_SIZE]);
+			used = 0;
+		}
+		void* mem = blocks.back() + used;
+		used += size;
+		return mem;
+	}
+
+	template<typename T>
+	static void _Destroy(void* obj)
+	{
+		static_cast<T*>(obj)->~T();
+	}
+};
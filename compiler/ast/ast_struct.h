@@ -1,34 +1,121 @@
 #pragma once
 #include "public.h"
+#include "ast_arena.h"
 
+enum StatKind
+{
+	STAT_EMPTY,
+	STAT_BREAK,
+	STAT_LABEL,
+	STAT_GOTO,
+	STAT_DO,
+	STAT_WHILE,
+	STAT_REPEAT,
+	STAT_IF,
+	STAT_FOR_NUM,
+	STAT_FOR_IN,
+	STAT_LOCAL_VAR_DECL,
+	STAT_ASSIGN,
+	STAT_LOCAL_FUNC_DEF,
+	STAT_FUNC_CALL,
+};
+
+enum ExpKind
+{
+	EXP_NIL,
+	EXP_TRUE,
+	EXP_FALSE,
+	EXP_VARARG,
+	EXP_INTEGER,
+	EXP_FLOAT,
+	EXP_STRING,
+	EXP_NAME,
+	EXP_UNOP,
+	EXP_BINOP,
+	EXP_CONCAT,
+	EXP_TABLE_CONSTRUCTOR,
+	EXP_FUNC_DEF,
+	EXP_PARENS,
+	EXP_TABLE_ACCESS,
+	EXP_FUNC_CALL,
+};
+
+// Nodes are tagged with their kind, visitors switch on it and IsA / Cast only compare it.
+// They come from the arena of the running compilation and die with it.
 struct Stat;
-using StatPtr = std::shared_ptr<Stat>;
+using StatPtr = Stat*;
 
-struct Stat : public RTTI
+struct Stat
 {
+	const StatKind Kind;
+
+	explicit Stat(StatKind kind) : Kind(kind) {}
+
 	template<typename T>
-	static StatPtr New()
+	static T* New()
 	{
-		StatPtr ret = StatPtr(new T());
-		return ret;
+		return AstArena::Current()->New<T>();
+	}
+
+	template<typename T>
+	bool IsA() const
+	{
+		return Kind == T::KIND;
+	}
+
+	template<typename T>
+	T* Cast()
+	{
+		return IsA<T>() ? static_cast<T*>(this) : nullptr;
 	}
 };
 using StatArray = std::vector<StatPtr>;
 
+template<StatKind K>
+struct StatOf : public Stat
+{
+	static const StatKind KIND = K;
+
+	StatOf() : Stat(K) {}
+};
+
 struct Exp;
-using ExpPtr = std::shared_ptr<Exp>;
+using ExpPtr = Exp*;
 
-struct Exp : public RTTI
+struct Exp
 {
+	const ExpKind Kind;
+
+	explicit Exp(ExpKind kind) : Kind(kind) {}
+
+	template<typename T>
+	static T* New()
+	{
+		return AstArena::Current()->New<T>();
+	}
+
 	template<typename T>
-	static ExpPtr New()
+	bool IsA() const
 	{
-		ExpPtr ret = ExpPtr(new T());
-		return ret;
+		return Kind == T::KIND;
+	}
+
+	template<typename T>
+	T* Cast()
+	{
+		return IsA<T>() ? static_cast<T*>(this) : nullptr;
 	}
 };
 using ExpArray = std::vector<ExpPtr>;
 
+template<ExpKind K>
+struct ExpOf : public Exp
+{
+	static const ExpKind KIND = K;
+
+	ExpOf() : Exp(K) {}
+};
+
 struct Block;
-using BlockPtr = std::shared_ptr<Block>;
-using BlockArray = std::vector<BlockPtr>;
\ No newline at end of file
+using BlockPtr = Block*;
+using BlockArray = std::vector<BlockPtr>;
@@ -6,4 +6,6 @@ struct Block
 	int LastLine;
 	StatArray Stats;
 	ExpArray RetExps;
+	// RetExps is empty for a bare return as well
+	bool HasReturn;
 };
\ No newline at end of file
@@ -1,58 +1,58 @@
 #pragma once
 #include "ast_struct.h"
 
-struct NilExp : public Exp
+struct NilExp : public ExpOf<EXP_NIL>
 {
 	int Line;
 };
 
-struct TrueExp : public Exp
+struct TrueExp : public ExpOf<EXP_TRUE>
 {
 	int Line;
 };
 
-struct FalseExp : public Exp
+struct FalseExp : public ExpOf<EXP_FALSE>
 {
 	int Line;
 };
 
-struct VarargExp : public Exp
+struct VarargExp : public ExpOf<EXP_VARARG>
 {
 	int Line;
 };
 
-struct IntegerExp : public Exp
+struct IntegerExp : public ExpOf<EXP_INTEGER>
 {
 	int Line;
 	Int64 Val;
 };
 
-struct FloatExp : public Exp
+struct FloatExp : public ExpOf<EXP_FLOAT>
 {
 	int Line;
 	Float64 Val;
 };
 
-struct StringExp : public Exp
+struct StringExp : public ExpOf<EXP_STRING>
 {
 	int Line;
 	String Val;
 };
 
-struct NameExp : public Exp
+struct NameExp : public ExpOf<EXP_NAME>
 {
 	int Line;
 	String Name;
 };
 
-struct UnopExp : public Exp
+struct UnopExp : public ExpOf<EXP_UNOP>
 {
 	int Line;
 	int Op;
 	ExpPtr Exp;
 };
 
-struct BinopExp : public Exp
+struct BinopExp : public ExpOf<EXP_BINOP>
 {
 	int Line;
 	int Op;
@@ -60,7 +60,7 @@ struct BinopExp : public Exp
 	ExpPtr Exp2;
 };
 
-struct ConcatExp : public Exp
+struct ConcatExp : public ExpOf<EXP_CONCAT>
 {
 	int Line;
 	std::vector<ExpPtr> Exps;
@@ -70,7 +70,7 @@ struct ConcatExp : public Exp
 // fieldlist ::= field {fieldsep field} [fieldsep]
 // field ::= '[' exp ']' '=' exp | Name '=' exp | exp
 // fieldsep ::= ',' | ';'
-struct TableConstructorExp : public Exp
+struct TableConstructorExp : public ExpOf<EXP_TABLE_CONSTRUCTOR>
 {
 	int Line;
 	int LastLine;
@@ -82,7 +82,7 @@ struct TableConstructorExp : public Exp
 // funcbody ::= '(' [parlist] ')' block end
 // parlist ::= namelist [',' '...'] | '...'
 // namelist ::= Name {',' Name}
-struct FuncDefExp : public Exp
+struct FuncDefExp : public ExpOf<EXP_FUNC_DEF>
 {
 	int Line;
 	int LastLine;
@@ -91,12 +91,12 @@ struct FuncDefExp : public Exp
 	BlockPtr Block;
 };
 
-struct ParensExp : public Exp
+struct ParensExp : public ExpOf<EXP_PARENS>
 {
 	ExpPtr Exp;
 };
 
-struct TableAccessExp : public Exp
+struct TableAccessExp : public ExpOf<EXP_TABLE_ACCESS>
 {
 	int LastLine;
 	ExpPtr PrefixExp;
@@ -105,7 +105,7 @@ struct TableAccessExp : public Exp
 
 // functioncall ::= prefixexp [':' Name] args
 // args ::= '(' [explist] ')' | tableconstructor | LiteralString
-struct FuncCallExp : public Exp
+struct FuncCallExp : public ExpOf<EXP_FUNC_CALL>
 {
 	int Line;
 	int LastLine;
@@ -2,43 +2,45 @@
 #include "ast_struct.h"
 
 // ;
-struct EmptyStat : public Stat
+struct EmptyStat : public StatOf<STAT_EMPTY>
 {
 };
 
 // break
-struct BreakStat : public Stat
+struct BreakStat : public StatOf<STAT_BREAK>
 {
 	int Line;
 };
 
 // :: Name
-struct LabelStat : public Stat
+struct LabelStat : public StatOf<STAT_LABEL>
 {
 	String Name;
+	int Line;
 };
 
 // goto Name
-struct GotoStat : public Stat
+struct GotoStat : public StatOf<STAT_GOTO>
 {
 	String Name;
+	int Line;
 };
 
 // do block end
-struct DoStat : public Stat
+struct DoStat : public StatOf<STAT_DO>
 {
 	BlockPtr Block;
 };
 
 // while exp do block end
-struct WhileStat : public Stat
+struct WhileStat : public StatOf<STAT_WHILE>
 {
 	ExpPtr Exp;
 	BlockPtr Block;
 };
 
 // repeat block until exp
-struct RepeatStat : public Stat
+struct RepeatStat : public StatOf<STAT_REPEAT>
 {
 	BlockPtr Block;
 	ExpPtr Exp;
@@ -47,14 +49,14 @@ struct RepeatStat : public Stat
 // -> 0.if exp then block {elseif exp then block} [else block] end
 // -> 1.if exp then block {elseif exp then block} [elseif true then block] end
 // -> 2.if exp then block {elseif exp then block} end
-struct IfStat : public Stat
+struct IfStat : public StatOf<STAT_IF>
 {
 	ExpArray Exps;
 	BlockArray Blocks;
 };
 
 // for Name = exp , exp [, exp] do block end
-struct ForNumStat : public Stat
+struct ForNumStat : public StatOf<STAT_FOR_NUM>
 {
 	int LineOfFor;
 	int LineOfDo;
@@ -66,7 +68,7 @@ struct ForNumStat : public Stat
 };
 
 // for namelist in explist do block end
-struct ForInStat : public Stat
+struct ForInStat : public StatOf<STAT_FOR_IN>
 {
 	int LineOfDo;
 	StringArray NameList;
@@ -75,7 +77,7 @@ struct ForInStat : public Stat
 };
 
 // local namelist [= explist]
-struct LocalVarDeclStat : public Stat
+struct LocalVarDeclStat : public StatOf<STAT_LOCAL_VAR_DECL>
 {
 	int Line;
 	StringArray NameList;
@@ -83,7 +85,7 @@ struct LocalVarDeclStat : public Stat
 };
 
 // varlist = explist
-struct AssignStat : public Stat
+struct AssignStat : public StatOf<STAT_ASSIGN>
 {
 	int Line;
 	ExpArray VarList;
@@ -92,14 +94,14 @@ struct AssignStat : public Stat
 
 // -> 0.local function f (params) body end
 // -> 1.local f; f = function (params) body end
-struct LocalFuncDefStat : public Stat
+struct LocalFuncDefStat : public StatOf<STAT_LOCAL_FUNC_DEF>
 {
 	String Name;
 	// FuncDefExp
 	ExpPtr Exp;
 };
 
-struct FuncCallStat : public Stat
+struct FuncCallStat : public StatOf<STAT_FUNC_CALL>
 {
 	int Line;
 	int LastLine;
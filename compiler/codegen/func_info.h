@@ -46,6 +46,26 @@ struct UpvalInfo
 	}
 };
 
+// A label, or a goto waiting for its label. A break is a goto to the hidden label "break" of its loop
+struct LabelInfo
+{
+	String name;
+	// The instruction after the label, the JMP of a goto
+	int pc;
+	// Registers taken by the locals in scope
+	int nActVars;
+	int line;
+};
+
+struct BlockInfo
+{
+	bool breakable;
+	int nActVars;
+	// Where the labels and pending gotos of the block start
+	size_t firstLabel;
+	size_t firstGoto;
+};
+
 struct FuncInfo;
 using FuncInfoPtr = std::shared_ptr<FuncInfo>;
 
@@ -59,10 +79,12 @@ struct FuncInfo
 	std::vector<LocVarInfoPtr> locVars;
 	// Record the current local variables in effect
 	std::unordered_map<String, LocVarInfoPtr> locNames;
-	// Break table
-	using BreakTableElem = std::vector<int>;
-	using BreakTableElemPtr = std::shared_ptr<BreakTableElem>;
-	std::vector<BreakTableElemPtr> breaks;
+	// Open scopes, the function body is scope 0
+	std::vector<BlockInfo> blocks;
+	// Labels visible in the open scopes
+	std::vector<LabelInfo> labels;
+	// Gotos and breaks not backpatched yet
+	std::vector<LabelInfo> gotos;
 	// Upvalues
 	FuncInfoPtr parent;
 	std::unordered_map<String, UpvalInfoPtr> upvalues;
@@ -73,6 +95,8 @@ struct FuncInfo
 	std::vector<FuncInfoPtr> subFuncs;
 	int numParams;
 	bool isVararg;
+	int line;
+	int lastLine;
 
 	FuncInfo()
 	{
@@ -81,7 +105,9 @@ struct FuncInfo
 		scopeLv = 0;
 		numParams = 0;
 		isVararg = false;
-		breaks = {nullptr};
+		line = 0;
+		lastLine = 0;
+		blocks.push_back({false, 0, 0, 0});
 
 		arithAndBitwiseBinops.insert({TOKEN_OP_ADD, OP_ADD});
 		arithAndBitwiseBinops.insert({TOKEN_OP_SUB, OP_SUB});
@@ -104,7 +130,11 @@ struct FuncInfo
 	void FreeRegs(int n);
 
 	LocVarInfoPtr _CurrentLocVar(const String& name);
-	void AddBreakJmp(int pc);
+	void AddBreakJmp(int pc, int line);
+	void AddGotoJmp(int pc, const String& name, int line);
+	void AddLabel(const String& name, int line, bool atBlockEnd);
+	bool _FindLabel(size_t g);
+	void _CloseGoto(size_t g, const LabelInfo& label);
 	void EnterScope(bool breakable);
 	int AddLocVar(const String& name);
 	int SlotOfLocVar(const String& name);
@@ -115,6 +145,7 @@ struct FuncInfo
 
 	int PC();
 	void FixSbx(int pc, int sBx);
+	void FixA(int pc, int a);
 
 	void CloseOpenUpvals();
 	int GetJmpArgA();
@@ -152,39 +183,51 @@ struct FuncInfo
 	void EmitBinaryOp(int op, int a, int b, int c);
 };
 
+// What an instruction operand may be besides a fresh register, see ExpToOpArg
+enum OpArgKind
+{
+	ARG_CONST = 1, // constant index + 0x100, for the RK operands
+	ARG_LOCAL = 2, // the register of a local variable, used in place
+	ARG_RK = ARG_CONST | ARG_LOCAL,
+};
+
 bool IsVarargOrFuncCall(ExpPtr exp);
-void CGBlock(FuncInfoPtr fi, BlockPtr node);
+int ExpToOpArg(FuncInfoPtr fi, ExpPtr exp, int argKinds, int& allocated);
+int CGJmpIfFalse(FuncInfoPtr fi, ExpPtr exp, int jmpA);
+void CGBlock(FuncInfoPtr fi, BlockPtr node, bool untilFollows = false);
 void CGRetStat(FuncInfoPtr fi, const ExpArray& exps);
 void CGStat(FuncInfoPtr fi, StatPtr node);
-void CGLocalFuncDefStat(FuncInfoPtr fi, StatPtr node);
-void CGFuncCall(FuncInfoPtr fi, StatPtr node);
-void CGBreakStat(FuncInfoPtr fi, StatPtr node);
-void CGDoStat(FuncInfoPtr fi, StatPtr node);
-void CGWhileStat(FuncInfoPtr fi, StatPtr node);
-void CGRepeatStat(FuncInfoPtr fi, StatPtr node);
-void CGIfStat(FuncInfoPtr fi, StatPtr node);
-void CGForNumStat(FuncInfoPtr fi, StatPtr node);
-void CGForInStat(FuncInfoPtr fi, StatPtr node);
-void CGLocalVarDeclStat(FuncInfoPtr fi, StatPtr node);
-void CGAssignStat(FuncInfoPtr fi, StatPtr node);
+void CGLocalFuncDefStat(FuncInfoPtr fi, LocalFuncDefStat* stat);
+void CGFuncCall(FuncInfoPtr fi, FuncCallStat* stat);
+void CGBreakStat(FuncInfoPtr fi, BreakStat* stat);
+void CGLabelStat(FuncInfoPtr fi, LabelStat* stat, bool atBlockEnd);
+void CGGotoStat(FuncInfoPtr fi, GotoStat* stat);
+void CGDoStat(FuncInfoPtr fi, DoStat* stat);
+void CGWhileStat(FuncInfoPtr fi, WhileStat* stat);
+void CGRepeatStat(FuncInfoPtr fi, RepeatStat* stat);
+void CGIfStat(FuncInfoPtr fi, IfStat* stat);
+void CGForNumStat(FuncInfoPtr fi, ForNumStat* stat);
+void CGForInStat(FuncInfoPtr fi, ForInStat* stat);
+void CGLocalVarDeclStat(FuncInfoPtr fi, LocalVarDeclStat* stat);
+void CGAssignStat(FuncInfoPtr fi, AssignStat* stat);
 
 void CGExp(FuncInfoPtr fi, ExpPtr node, int a, int n);
-void CGVarargExp(FuncInfoPtr fi, ExpPtr node, int a, int n);
-void CGFuncDefExp(FuncInfoPtr fi, ExpPtr node, int a);
-void CGTableConstructorExp(FuncInfoPtr fi, ExpPtr node, int a);
-void CGUnopExp(FuncInfoPtr fi, ExpPtr node, int a);
-void CGBinopExp(FuncInfoPtr fi, ExpPtr node, int a);
-void CGConcatExp(FuncInfoPtr fi, ExpPtr node, int a);
-void CGNameExp(FuncInfoPtr fi, ExpPtr node, int a);
-void CGTableAceessExp(FuncInfoPtr fi, ExpPtr node, int a);
+void CGVarargExp(FuncInfoPtr fi, int a, int n);
+void CGFuncDefExp(FuncInfoPtr fi, FuncDefExp* exp, int a);
+void CGTableConstructorExp(FuncInfoPtr fi, TableConstructorExp* exp, int a);
+void CGUnopExp(FuncInfoPtr fi, UnopExp* exp, int a);
+void CGBinopExp(FuncInfoPtr fi, BinopExp* exp, int a);
+void CGConcatExp(FuncInfoPtr fi, ConcatExp* exp, int a);
+void CGNameExp(FuncInfoPtr fi, NameExp* exp, int a);
+void CGTableAceessExp(FuncInfoPtr fi, TableAccessExp* exp, int a);
 int PrepFuncCall(FuncInfoPtr fi, FuncCallExp* node, int a);
-void CGFuncCallExp(FuncInfoPtr fi, ExpPtr node, int a, int n);
+void CGFuncCallExp(FuncInfoPtr fi, FuncCallExp* exp, int a, int n);
 
 FuncInfoPtr NewFuncInfo(FuncInfoPtr parent, FuncDefExp* fd);
 std::vector<PrototypePtr> ToProtos(const std::vector<FuncInfoPtr>& fis);
 Constant GetConstant(const LuaValue& val);
 std::vector<Constant> GetConstants(FuncInfoPtr fi);
 std::vector<Upvalue> GetUpvalues(FuncInfoPtr fi);
-PrototypePtr ToProto(FuncInfoPtr fi);
+std::shared_ptr<Prototype> ToProto(FuncInfoPtr fi);
 
-PrototypePtr GenProto(BlockPtr chunk);
\ No newline at end of file
+PrototypePtr GenProto(BlockPtr chunk, const String& chunkName);
\ No newline at end of file
@@ -1,8 +1,16 @@
 #pragma once
 #include "compiler/codegen/func_info.h"
+#include "vm/verifier.h"
 
-inline PrototypePtr Compile(const String& chunk, const String& chunkName)
+inline PrototypePtr Compile(const char* chunk, size_t length, const String& chunkName)
 {
-	BlockPtr ast = Parse(chunk, chunkName);
-	return GenProto(ast);
+	PrototypePtr proto;
+	{
+		// the syntax tree is freed at once as soon as the prototype is generated
+		AstArena arena;
+		BlockPtr ast = Parse(chunk, length, chunkName);
+		proto = GenProto(ast, chunkName);
+	}
+	VerifyProto(proto.get());
+	return proto;
 }
\ No newline at end of file
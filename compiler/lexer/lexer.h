@@ -1,7 +1,8 @@
 #pragma once
 #include "public.h"
+#include <cstring>
+#include <deque>
 #include <memory>
-#include <unordered_map>
 
 enum TokenKind
 {
@@ -70,37 +71,59 @@ enum TokenKind
 	TOKEN_OP_BXOR     = TOKEN_OP_WAVE,
 };
 
+// Bytes of the source buffer, or of a literal kept by the lexer, valid as long as the lexer
+struct StringView
+{
+	const char* data;
+	size_t size;
+
+	StringView() : data(""), size(0) {}
+	StringView(const char* _data, size_t _size) : data(_data), size(_size) {}
+	StringView(const String& str) : data(str.data()), size(str.size()) {}
+	template<size_t N>
+	StringView(const char (&str)[N]) : data(str), size(N - 1) {}
+
+	String Str() const { return String(data, size); }
+};
+
 struct TokenResult
 {
 	int line;
 	int kind;
-	String token;
+	StringView token;
 };
 
 struct TokenKindResult
 {
 	int line;
-	String token;
+	StringView token;
 };
 
+// Scans a source buffer it does not own, tokens point into it.
+// Only string literals whose value differs from their text (escapes, \r line breaks) are copied.
 class Lexer
 {
 protected:
 	// lexer data
-	String chunk;
+	const char* chunk;
+	size_t length;
 	String chunkName;
 	int line;
 	// cache data
-	String nextToken;
+	StringView nextToken;
 	int nextTokenKind;
 	int nextTokenLine;
-	// constant data
-	std::unordered_map<String, int> keywords;
+	// values of the literals that needed a copy, a deque keeps them in place
+	std::deque<String> literals;
 	// peek index
 	size_t peekIndex;
 
 	void SkipWhiteSpaces();
-	bool Test(const String& s);
+	template<size_t N>
+	bool Test(const char (&s)[N]) const
+	{
+		return peekIndex + N - 1 <= length && memcmp(chunk + peekIndex, s, N - 1) == 0;
+	}
 	void Next(int n);
 	bool Peek(Byte c);
 	bool IsWhileSpace(Byte c);
@@ -110,16 +133,19 @@ protected:
 	bool IsFinish();
 	bool IsNewLine(Byte c);
 	void SkipComment();
-	String ScanLongString();
-	String ScanShortString();
-	String ScanNumber();
-	String ScanIdentifier();
+	StringView ScanLongString();
+	StringView ScanShortString();
+	StringView ScanNumber();
+	StringView ScanIdentifier();
+	StringView Keep(String&& str);
+	// Kind of a reserved word, TOKEN_IDENTIFIER for any other name
+	static int KeywordKind(const char* s, size_t n);
 	// Convert literally visible escape characters into truly invisible escape characters
 	String Escape(const String& str);
 	String ReplaceLine(const String& str);
-	size_t Count(const String& str, Byte c);
+	size_t Count(StringView str, Byte c);
 public:
-	Lexer(const String& _chunk, const String& _chunkName, int _line);
+	Lexer(const char* _chunk, size_t _length, const String& _chunkName, int _line);
 
 	TokenResult NextToken();
 	TokenKindResult NextTokenKind(int kind);
@@ -131,7 +157,7 @@ public:
 
 using LexerPtr = std::shared_ptr<Lexer>;
 
-inline LexerPtr NewLexer(const String& chunk, const String& chunkName)
+inline LexerPtr NewLexer(const char* chunk, size_t length, const String& chunkName)
 {
-	return LexerPtr(new Lexer(chunk, chunkName, 1));
+	return LexerPtr(new Lexer(chunk, length, chunkName, 1));
 }
\ No newline at end of file
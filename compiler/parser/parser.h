@@ -5,9 +5,10 @@
 #include "compiler/parser/parser_block.h"
 #include "compiler/lexer/lexer.h"
 
-inline BlockPtr Parse(const String& chunk, const String& chunkName)
+// chunk is borrowed, it must outlive the syntax tree
+inline BlockPtr Parse(const char* chunk, size_t length, const String& chunkName)
 {
-	LexerPtr lexer = NewLexer(chunk, chunkName);
+	LexerPtr lexer = NewLexer(chunk, length, chunkName);
 	BlockPtr block = ParseBlock(lexer);
 	lexer->NextTokenKind(TOKEN_EOF);
 	return block;
@@ -11,39 +11,46 @@
 	panic(msg.c_str());\
 }
 
-Lexer::Lexer(const String& _chunk, const String& _chunkName, int _line)
+Lexer::Lexer(const char* _chunk, size_t _length, const String& _chunkName, int _line)
 {
 	chunk = _chunk;
+	length = _length;
 	chunkName = _chunkName;
 	line = _line;
 	peekIndex = 0;
 
-	nextToken = "";
 	nextTokenKind = 0;
 	nextTokenLine = 0;
+}
+
+int Lexer::KeywordKind(const char* s, size_t n)
+{
+#define KEYWORD(str, kind) if(n == sizeof(str) - 1 && memcmp(s, str, n) == 0) return kind
+	switch(s[0])
+	{
+		case 'a': KEYWORD("and", TOKEN_OP_AND); break;
+		case 'b': KEYWORD("break", TOKEN_KW_BREAK); break;
+		case 'd': KEYWORD("do", TOKEN_KW_DO); break;
+		case 'e': KEYWORD("end", TOKEN_KW_END); KEYWORD("else", TOKEN_KW_ELSE); KEYWORD("elseif", TOKEN_KW_ELSEIF); break;
+		case 'f': KEYWORD("for", TOKEN_KW_FOR); KEYWORD("false", TOKEN_KW_FALSE); KEYWORD("function", TOKEN_KW_FUNCTION); break;
+		case 'g': KEYWORD("goto", TOKEN_KW_GOTO); break;
+		case 'i': KEYWORD("if", TOKEN_KW_IF); KEYWORD("in", TOKEN_KW_IN); break;
+		case 'l': KEYWORD("local", TOKEN_KW_LOCAL); break;
+		case 'n': KEYWORD("nil", TOKEN_KW_NIL); KEYWORD("not", TOKEN_OP_NOT); break;
+		case 'o': KEYWORD("or", TOKEN_OP_OR); break;
+		case 'r': KEYWORD("return", TOKEN_KW_RETURN); KEYWORD("repeat", TOKEN_KW_REPEAT); break;
+		case 't': KEYWORD("then", TOKEN_KW_THEN); KEYWORD("true", TOKEN_KW_TRUE); break;
+		case 'u': KEYWORD("until", TOKEN_KW_UNTIL); break;
+		case 'w': KEYWORD("while", TOKEN_KW_WHILE); break;
+	}
+#undef KEYWORD
+	return TOKEN_IDENTIFIER;
+}
 
-	keywords.insert({"and", TOKEN_OP_AND});
-	keywords.insert({"break", TOKEN_KW_BREAK});
-	keywords.insert({"do", TOKEN_KW_DO});
-	keywords.insert({"else", TOKEN_KW_ELSE});
-	keywords.insert({"elseif", TOKEN_KW_ELSEIF});
-	keywords.insert({"end", TOKEN_KW_END});
-	keywords.insert({"false", TOKEN_KW_FALSE});
-	keywords.insert({"for", TOKEN_KW_FOR});
-	keywords.insert({"function", TOKEN_KW_FUNCTION});
-	keywords.insert({"goto", TOKEN_KW_GOTO});
-	keywords.insert({"if", TOKEN_KW_IF});
-	keywords.insert({"in", TOKEN_KW_IN});
-	keywords.insert({"local", TOKEN_KW_LOCAL});
-	keywords.insert({"nil", TOKEN_KW_NIL});
-	keywords.insert({"not", TOKEN_OP_NOT});
-	keywords.insert({"or", TOKEN_OP_OR});
-	keywords.insert({"repeat", TOKEN_KW_REPEAT});
-	keywords.insert({"return", TOKEN_KW_RETURN});
-	keywords.insert({"then", TOKEN_KW_THEN});
-	keywords.insert({"true", TOKEN_KW_TRUE});
-	keywords.insert({"until", TOKEN_KW_UNTIL});
-	keywords.insert({"while", TOKEN_KW_WHILE});	
+StringView Lexer::Keep(String&& str)
+{
+	literals.push_back(std::move(str));
+	return StringView(literals.back());
 }
 
 TokenResult Lexer::NextToken()
@@ -57,7 +64,7 @@ TokenResult Lexer::NextToken()
 	}
 
 	SkipWhiteSpaces();
-	if(peekIndex == chunk.length())
+	if(peekIndex == length)
 	{
 		return {line, TOKEN_EOF, "EOF"};
 	}
@@ -163,7 +170,7 @@ TokenResult Lexer::NextToken()
 			{
 				Next(2); return {line, TOKEN_OP_CONCAT, ".."};
 			}
-			else if(peekIndex == chunk.length() - 1 || !IsDigit(chunk[peekIndex + 1]))
+			else if(peekIndex == length - 1 || !IsDigit(chunk[peekIndex + 1]))
 			{
 				Next(1); return {line, TOKEN_SEP_DOT, "."};
 			}
@@ -193,17 +200,8 @@ TokenResult Lexer::NextToken()
 	}
 	if(c == '_' || IsLetter(c))
 	{
-		String token = ScanIdentifier();
-		auto it = keywords.find(token);
-		if(it != keywords.end())
-		{
-			TokenKind kind = TokenKind(it->second);
-			return {line, kind, token};
-		}
-		else
-		{
-			return {line, TOKEN_IDENTIFIER, token};
-		}
+		StringView token = ScanIdentifier();
+		return {line, KeywordKind(token.data, token.size), token};
 	}
 
 	Error("unreachable!");
@@ -215,7 +213,7 @@ TokenKindResult Lexer::NextTokenKind(int kind)
 	TokenResult res = NextToken();
 	if(res.kind != kind)
 	{
-		Error("syntax error near '%s'", res.token);
+		Error("syntax error near '%s'", res.token.Str().c_str());
 	}
 	return {res.line, res.token};
 }
@@ -247,7 +245,7 @@ int Lexer::LookAhead()
 
 void Lexer::SkipWhiteSpaces()
 {
-	while(peekIndex < chunk.length())
+	while(peekIndex < length)
 	{
 		if(Test("--"))
 		{
@@ -274,20 +272,12 @@ void Lexer::SkipWhiteSpaces()
 	}
 }
 
-bool Lexer::Test(const String& s)
-{
-	if(peekIndex + s.length() <= chunk.length() &&
-		chunk.substr(peekIndex, s.length()) == s)
-		return true;
-	return false;
-}
-
 void Lexer::Next(int n)
 {
-	if(peekIndex + n <= chunk.length())
+	if(peekIndex + n <= length)
 		peekIndex += n;
 	else
-		peekIndex = chunk.length();
+		peekIndex = length;
 }
 
 bool Lexer::IsWhileSpace(Byte c)
@@ -337,7 +327,7 @@ bool Lexer::IsLetter(Byte c)
 
 bool Lexer::IsFinish()
 {
-	return peekIndex >= chunk.length();
+	return peekIndex >= length;
 }
 
 void Lexer::SkipComment()
@@ -346,9 +336,9 @@ void Lexer::SkipComment()
 	if(Peek('['))
 	{
 		size_t tempPeekIndex = peekIndex + 1;
-		while(tempPeekIndex < chunk.length() && chunk[tempPeekIndex] == '=')
+		while(tempPeekIndex < length && chunk[tempPeekIndex] == '=')
 			++tempPeekIndex;
-		if(tempPeekIndex < chunk.length() && chunk[tempPeekIndex] == '[')
+		if(tempPeekIndex < length && chunk[tempPeekIndex] == '[')
 		{
 			ScanLongString();
 			return;
@@ -358,11 +348,10 @@ void Lexer::SkipComment()
 		Next(1);
 }
 
-String Lexer::ScanLongString()
+StringView Lexer::ScanLongString()
 {
 	size_t leftEqualCount = 0, rightEqualCount = 0;
 	size_t start = 0, end = 0;
-	String str;
 
 	if(!Peek('['))
 		Error("invalid long string missing [");
@@ -400,23 +389,28 @@ String Lexer::ScanLongString()
 	if(leftEqualCount != rightEqualCount)
 		Error("invalid long string missing left = count is not equal to right = count");
 
-	str = chunk.substr(start, end - start);
-	str = ReplaceLine(str);
+	// a first line break is skipped
+	StringView raw(chunk + start, end - start);
+	if(memchr(raw.data, '\r', raw.size) == nullptr)
+	{
+		line += (int)Count(raw, '\n');
+		if(raw.size > 0 && raw.data[0] == '\n')
+			raw = StringView(raw.data + 1, raw.size - 1);
+		return raw;
+	}
 
+	String str = ReplaceLine(raw.Str());
 	line += (int)Count(str, '\n');
-
 	if(str.length() > 0 && str[0] == '\n')
 		str = str.substr(1);
-	
-	return str;
+	return Keep(std::move(str));
 }
 
-String Lexer::ScanShortString()
+StringView Lexer::ScanShortString()
 {
 	Byte brack = 0;
 	size_t beg = 0, end = 0;
 	bool closed = false;
-	String str;
 
 	if(Peek('\''))
 	{
@@ -461,15 +455,19 @@ String Lexer::ScanShortString()
 	if(!closed)
 		Error("invalid short string not closed");
 
-	str = chunk.substr(beg, end - beg);
-	str = ReplaceLine(str);
-	line += (int)Count(str, '\n');
-	str = Escape(str);
+	StringView raw(chunk + beg, end - beg);
+	if(memchr(raw.data, '\\', raw.size) == nullptr && memchr(raw.data, '\r', raw.size) == nullptr)
+	{
+		line += (int)Count(raw, '\n');
+		return raw;
+	}
 
-	return str;
+	String str = ReplaceLine(raw.Str());
+	line += (int)Count(str, '\n');
+	return Keep(Escape(str));
 }
 
-String Lexer::ScanNumber()
+StringView Lexer::ScanNumber()
 {
 	if(!IsFinish())
 	{
@@ -506,7 +504,7 @@ String Lexer::ScanNumber()
 					Next(1);
 			}
 			end = peekIndex;
-			return chunk.substr(beg, end - beg);
+			return StringView(chunk + beg, end - beg);
 		}
 		else if(IsDigit(chunk[peekIndex]))
 		{
@@ -538,14 +536,14 @@ String Lexer::ScanNumber()
 					Next(1);
 			}
 			end = peekIndex;
-			return chunk.substr(beg, end - beg);
+			return StringView(chunk + beg, end - beg);
 		}
 	}
 	Error("unreachable!");
 	return "0";
 }
 
-String Lexer::ScanIdentifier()
+StringView Lexer::ScanIdentifier()
 {
 	if(!IsFinish())
 	{
@@ -560,7 +558,7 @@ String Lexer::ScanIdentifier()
 					Peek('_')))
 				Next(1);
 			end = peekIndex;
-			return chunk.substr(beg, end - beg);
+			return StringView(chunk + beg, end - beg);
 		}
 	}
 	Error("unreachable!");
@@ -785,12 +783,12 @@ String Lexer::ReplaceLine(const String& str)
 	return res;
 }
 
-size_t Lexer::Count(const String& str, Byte c)
+size_t Lexer::Count(StringView str, Byte c)
 {
 	size_t count = 0;
-	for(size_t i = 0; i < str.length(); ++i)
+	for(size_t i = 0; i < str.size; ++i)
 	{
-		if(str[i] == c)
+		if((Byte)str.data[i] == c)
 			++count;
 	}
 	return count;
@@ -1,6 +1,9 @@
 #include "stdlib/lib_basic.h"
 #include "stdlib/lib_package.h"
 #include "stdlib/lib_coroutine.h"
+#include "stdlib/lib_string.h"
+#include "stdlib/lib_table.h"
+#include "state/lua_buffer.h"
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -242,13 +245,7 @@ int BaseLoad(LuaState* ls)
 		/* loading a string? */
 		String chunkName = ls->OptString(2, chunk);
 
-		ByteArray chunkByte;
-		chunkByte.reserve(chunk.size());
-		for(const Byte& c : chunk)
-		{
-			chunkByte.push_back(c);
-		}
-		status = ls->Load(chunkByte, chunkName, mode);
+		status = ls->Load((const Byte*)chunk.data(), chunk.size(), chunkName, mode);
 	}
 	else
 	{
@@ -425,6 +422,63 @@ int BaseToNumber(LuaState* ls)
 	return 1;
 }
 
+int BaseCollectGarbage(LuaState* ls)
+{
+	static const char* const opts[] = {"stop", "restart", "collect",
+		"count", "step", "setpause", "setstepmul",
+		"isrunning", "generational", "incremental", nullptr};
+	static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
+		LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
+		LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC};
+	String name = ls->OptString(1, "collect");
+	int o = 0;
+	while(opts[o] && name != opts[o])
+		++o;
+	ls->ArgCheck(opts[o] != nullptr, 1, "invalid option '" + name + "'");
+	int what = optsnum[o];
+
+	switch(what)
+	{
+		case LUA_GCCOUNT:
+		{
+			int k = ls->GC(LUA_GCCOUNT, 0);
+			int b = ls->GC(LUA_GCCOUNTB, 0);
+			ls->PushNumber((Float64)k + ((Float64)b / 1024));
+			return 1;
+		}
+		case LUA_GCSTEP:
+		case LUA_GCISRUNNING:
+		{
+			int res = ls->GC(what, (int)ls->OptInteger(2, 0));
+			ls->PushBoolean(res != 0);
+			return 1;
+		}
+		case LUA_GCGEN:
+		case LUA_GCINC:
+		{
+			if(what == LUA_GCINC)
+			{
+				/* optional pause and step multiplier, 0 keeps the current one */
+				int pause = (int)ls->OptInteger(2, 0);
+				int stepmul = (int)ls->OptInteger(3, 0);
+				if(pause != 0)
+					ls->GC(LUA_GCSETPAUSE, pause);
+				if(stepmul != 0)
+					ls->GC(LUA_GCSETSTEPMUL, stepmul);
+			}
+			int prev = ls->GC(what, 0);
+			ls->PushString(prev == LUA_GCGEN ? "generational" : "incremental");
+			return 1;
+		}
+		default:
+		{
+			int res = ls->GC(what, (int)ls->OptInteger(2, 0));
+			ls->PushInteger(res);
+			return 1;
+		}
+	}
+}
+
 // Package Library
 
 int OpenPackageLib(LuaState* ls)
@@ -804,4 +858,57 @@ int CoWrap(LuaState* ls)
 {
 	panic("todo: coWrap!");
 	return 0;
+}
+
+/* String */
+int OpenStringLib(LuaState* ls)
+{
+	ls->NewLib(StrFuncs);
+	return 1;
+}
+
+int StrDump(LuaState* ls)
+{
+	bool strip = ls->ToBoolean(2);
+	ls->CheckType(1, LUA_TFUNCTION);
+	ls->SetTop(1);
+	ByteArray chunk;
+	if(ls->Dump(chunk, strip) != 0)
+		ls->Error2("unable to dump given function");
+	ls->PushString(String((const char*)chunk.data(), chunk.size()));
+	return 1;
+}
+
+/* Table */
+int OpenTableLib(LuaState* ls)
+{
+	ls->NewLib(TabFuncs);
+	return 1;
+}
+
+static void _AddField(LuaState* ls, LuaBuffer& b, Int64 i)
+{
+	ls->GetI(1, i);
+	if(!ls->IsString(-1))
+		ls->Error2(Format::FormatString("invalid value (at index %lld) in table for 'concat'", (long long)i).c_str());
+	b.AddValue();
+}
+
+int TabConcat(LuaState* ls)
+{
+	ls->CheckType(1, LUA_TTABLE);
+	Int64 last = ls->Len2(1);
+	String sep = ls->OptString(2, "");
+	Int64 i = ls->OptInteger(3, 1);
+	last = ls->OptInteger(4, last);
+	LuaBuffer b(ls);
+	for(; i < last; ++i)
+	{
+		_AddField(ls, b, i);
+		b.AddString(sep);
+	}
+	if(i == last)
+		_AddField(ls, b, i);
+	b.PushResult();
+	return 1;
 }
\ No newline at end of file
@@ -0,0 +1,409 @@
+#include "state/lua_gc.h"
+#include "state/lua_state.h"
+
+LuaGC g_gc;
+
+LuaGC::LuaGC()
+{
+	allgc = oldgc = sweepgc = nullptr;
+	mode = GC_INCREMENTAL;
+	state = GCS_PAUSE;
+	running = true;
+	minor = false;
+	totalbytes = 0;
+	threshold = GC_STEPSIZE * 8;
+	estimate = 0;
+	sweepAllocated = 0;
+	majorBase = 0;
+	pause = 200;
+	stepmul = 200;
+	minormul = 20;
+	majormul = 100;
+}
+
+void LuaGC::Link(LuaObject* o)
+{
+	o->gcnext = allgc;
+	allgc = o;
+	size_t size = o->Size();
+	totalbytes += size;
+	if(state == GCS_SWEEP)
+		sweepAllocated += size;
+}
+
+void LuaGC::MarkObject(LuaObject* o)
+{
+	if(o == nullptr || (o->marked & (GC_GRAY | GC_BLACK)))
+		return;
+	// old objects can only reach young ones through a barrier
+	if(minor && (o->marked & GC_OLD))
+		return;
+	o->marked |= GC_GRAY;
+	gray.push_back(o);
+}
+
+void LuaGC::MarkValue(const LuaValue& v)
+{
+	if(v.IsCollectable())
+		MarkObject(v.gc);
+}
+
+void LuaGC::_BarrierBack(LuaObject* o)
+{
+	if(mode == GC_GENERATIONAL)
+	{
+		if((o->marked & GC_OLD) && !(o->marked & GC_TOUCHED))
+		{
+			o->marked |= GC_TOUCHED;
+			touched.push_back(o);
+		}
+	}
+	else if(state == GCS_PROPAGATE && (o->marked & GC_BLACK))
+	{
+		// traverse it again before the cycle ends
+		o->marked = (o->marked & ~GC_BLACK) | GC_GRAY;
+		gray.push_back(o);
+	}
+}
+
+void LuaGC::_BarrierForward(LuaObject* o)
+{
+	if(mode == GC_GENERATIONAL)
+	{
+		if(!(o->marked & GC_TOUCHED))
+		{
+			o->marked |= GC_TOUCHED;
+			touched.push_back(o);
+		}
+	}
+	else if(state == GCS_PROPAGATE)
+	{
+		MarkObject(o);
+	}
+}
+
+void LuaGC::AddRoot(LuaState* ls)
+{
+	roots.push_back(ls);
+}
+
+void LuaGC::RemoveThread(LuaState* ls)
+{
+	auto it = std::find(threads.begin(), threads.end(), ls);
+	if(it != threads.end())
+	{
+		*it = threads.back();
+		threads.pop_back();
+	}
+}
+
+void LuaGC::_MarkRoots()
+{
+	for(LuaState* ls : roots)
+		MarkObject(ls);
+	// prototypes may be shared and outlive their closures, they keep their constants
+	for(const Prototype* p : protos)
+		MarkProto(p);
+}
+
+size_t LuaGC::_PropagateMark()
+{
+	LuaObject* o = gray.back();
+	gray.pop_back();
+	o->marked = (o->marked & ~GC_GRAY) | GC_BLACK;
+	o->Traverse(this);
+	return o->Size();
+}
+
+void LuaGC::_PropagateAll()
+{
+	while(!gray.empty())
+		_PropagateMark();
+}
+
+void LuaGC::_Atomic()
+{
+	_MarkRoots();
+	_PropagateAll();
+	// stacks are written without barriers, traverse every reached thread again
+	for(size_t i = 0; i < threads.size(); ++i)
+	{
+		if(threads[i]->marked & GC_BLACK)
+			threads[i]->Traverse(this);
+	}
+	_PropagateAll();
+
+	// objects allocated from now on go to a fresh list and are never swept in this cycle
+	sweepgc = allgc;
+	allgc = nullptr;
+	estimate = 0;
+	sweepAllocated = 0;
+	state = GCS_SWEEP;
+}
+
+bool LuaGC::_SweepStep()
+{
+	for(size_t i = 0; i < GC_SWEEPMAX && sweepgc; ++i)
+	{
+		LuaObject* o = sweepgc;
+		sweepgc = o->gcnext;
+		if(o->marked & GC_BLACK)
+		{
+			o->marked &= ~GC_BLACK;
+			o->gcnext = allgc;
+			allgc = o;
+			estimate += o->Size();
+		}
+		else
+		{
+			_Free(o);
+		}
+	}
+	return sweepgc == nullptr;
+}
+
+void LuaGC::_FinishCycle()
+{
+	state = GCS_PAUSE;
+	totalbytes = estimate + sweepAllocated;
+	threshold = std::max(estimate / 100 * pause, totalbytes + GC_STEPSIZE);
+}
+
+void LuaGC::_Free(LuaObject* o)
+{
+	size_t size = o->Size();
+	totalbytes = totalbytes > size ? totalbytes - size : 0;
+	delete o;
+}
+
+bool LuaGC::Step()
+{
+	if(mode == GC_GENERATIONAL)
+	{
+		if(totalbytes > majorBase / 100 * (100 + majormul))
+			_MajorGen();
+		else
+			_MinorGen();
+		return true;
+	}
+
+	Int64 work = (Int64)(GC_STEPSIZE * stepmul / 100);
+	while(work > 0)
+	{
+		switch(state)
+		{
+			case GCS_PAUSE:
+			{
+				gray.clear();
+				_MarkRoots();
+				state = GCS_PROPAGATE;
+				break;
+			}
+			case GCS_PROPAGATE:
+			{
+				if(gray.empty())
+					_Atomic();
+				else
+					work -= (Int64)_PropagateMark();
+				break;
+			}
+			case GCS_SWEEP:
+			{
+				if(_SweepStep())
+				{
+					_FinishCycle();
+					return true;
+				}
+				work -= (Int64)(GC_SWEEPMAX * GC_SWEEPCOST);
+				break;
+			}
+		}
+	}
+	threshold = totalbytes + GC_STEPSIZE;
+	return false;
+}
+
+void LuaGC::FullGC()
+{
+	if(mode == GC_GENERATIONAL)
+	{
+		_MajorGen();
+		return;
+	}
+	// finish the pending cycle, whatever was marked in it may be stale
+	while(state != GCS_PAUSE)
+		Step();
+	do
+	{
+		Step();
+	}
+	while(state != GCS_PAUSE);
+}
+
+void LuaGC::_MinorGen()
+{
+	minor = true;
+	gray.clear();
+	_MarkRoots();
+	// old threads are not traversed through marking but their stacks may hold young objects
+	for(size_t i = 0; i < threads.size(); ++i)
+	{
+		if(threads[i]->marked & GC_OLD)
+			threads[i]->Traverse(this);
+	}
+	for(LuaObject* o : touched)
+	{
+		if(o->marked & GC_OLD)
+			o->Traverse(this);
+		else
+			MarkObject(o);
+	}
+	_PropagateAll();
+
+	LuaObject* o = allgc;
+	allgc = nullptr;
+	while(o)
+	{
+		LuaObject* next = o->gcnext;
+		if(o->marked & GC_BLACK)
+		{
+			o->marked = GC_OLD;
+			o->gcnext = oldgc;
+			oldgc = o;
+		}
+		else
+		{
+			_Free(o);
+		}
+		o = next;
+	}
+
+	for(LuaObject* t : touched)
+		t->marked &= ~GC_TOUCHED;
+	touched.clear();
+	minor = false;
+	_SetGenThreshold();
+}
+
+void LuaGC::_MajorGen()
+{
+	gray.clear();
+	touched.clear();
+	_MarkRoots();
+	_PropagateAll();
+
+	LuaObject* lists[2] = { allgc, oldgc };
+	allgc = oldgc = nullptr;
+	estimate = 0;
+	for(LuaObject* o : lists)
+	{
+		while(o)
+		{
+			LuaObject* next = o->gcnext;
+			if(o->marked & GC_BLACK)
+			{
+				o->marked = GC_OLD;
+				o->gcnext = oldgc;
+				oldgc = o;
+				estimate += o->Size();
+			}
+			else
+			{
+				_Free(o);
+			}
+			o = next;
+		}
+	}
+	totalbytes = estimate;
+	majorBase = estimate;
+	_SetGenThreshold();
+}
+
+void LuaGC::_SetGenThreshold()
+{
+	threshold = totalbytes + std::max(majorBase / 100 * minormul, GC_STEPSIZE);
+}
+
+GCMode LuaGC::SetMode(GCMode m)
+{
+	GCMode prev = mode;
+	if(m == mode)
+		return prev;
+
+	if(m == GC_GENERATIONAL)
+	{
+		// start from a clean heap, everything alive becomes old
+		FullGC();
+		mode = GC_GENERATIONAL;
+		_MajorGen();
+	}
+	else
+	{
+		LuaObject* o = oldgc;
+		while(o)
+		{
+			LuaObject* next = o->gcnext;
+			o->marked = 0;
+			o->gcnext = allgc;
+			allgc = o;
+			o = next;
+		}
+		for(o = allgc; o; o = o->gcnext)
+			o->marked = 0;
+		oldgc = nullptr;
+		touched.clear();
+		mode = GC_INCREMENTAL;
+		state = GCS_PAUSE;
+		threshold = std::max(totalbytes / 100 * pause, totalbytes + GC_STEPSIZE);
+	}
+	return prev;
+}
+
+void LuaTable::Traverse(LuaGC* gc)
+{
+	for(const LuaValue& val : arr)
+		gc->MarkValue(val);
+	// dead keys are kept alive too, probing still compares them
+	for(const Node& n : node)
+	{
+		gc->MarkValue(n.key);
+		gc->MarkValue(n.val);
+	}
+	gc->MarkObject(metatable.get());
+}
+
+void LuaGC::MarkProto(const Prototype* p)
+{
+	for(const LuaValue& k : p->K)
+		MarkValue(k);
+}
+
+void Closure::Traverse(LuaGC* gc)
+{
+	for(const UpValuePtr& uv : upvals)
+	{
+		if(uv)
+			gc->MarkValue(*uv->v);
+	}
+}
+
+void LuaState::Traverse(LuaGC* gc)
+{
+	gc->MarkObject(registry.get());
+	if(!stack)
+		return;
+	std::vector<LuaValue>& slots = stack->slots;
+	for(int i = 0; i < stack->top; ++i)
+		gc->MarkValue(slots[i]);
+	// the part above the top is dead, don't let it keep anything alive
+	for(size_t i = stack->top; i < slots.size(); ++i)
+		slots[i] = LuaValue::Nil;
+	for(UpValue* uv = stack->openupval.get(); uv; uv = uv->next.get())
+		gc->MarkValue(*uv->v);
+	for(CallInfo* ci = stack->ci; ci; ci = ci->prev)
+	{
+		for(const LuaValue& val : ci->varargs)
+			gc->MarkValue(val);
+		gc->MarkObject(ci->closure.get());
+	}
+}
@@ -5,72 +5,94 @@
 
 const LuaValue LuaValue::NoValue(LUA_TNONE);
 const LuaValue LuaValue::Nil(LUA_TNIL);
+const String LuaValue::EmptyString;
 
-const LuaValuePtr LuaValue::NoValuePtr(NewLuaValue(LuaValue(LUA_TNONE)));
-const LuaValuePtr LuaValue::NilPtr(NewLuaValue(LuaValue(LUA_TNIL)));
-
-const LuaTablePtr LuaTable::NilPtr(NewLuaTable(0, 0));
+LuaStack::LuaStack(int size, LuaState* _state)
+{
+	slots.resize(size, LuaValue::Nil);
+	ci = &baseCi;
+	state = _state;
+	top = 0;
+}
 
-size_t LuaValue::Hash() const
+LuaStack::~LuaStack()
 {
-	size_t hash = 0;
-	HashCombine(hash, tag);
-	// Be careful, hash the value by the tag
-	if(tag == LUA_TBOOLEAN)
+	// closures may outlive the thread, they keep the last values
+	CloseUpvalues(0);
+	CallInfo* next = baseCi.next;
+	while(next)
 	{
-		HashCombine(hash, boolean);
+		CallInfo* ci = next;
+		next = ci->next;
+		delete ci;
 	}
-	else if(tag == LUA_TNUMBER)
+}
+
+CallInfo* LuaStack::PushFrame(const ClosurePtr& c, int func, int nResults)
+{
+	CallInfo* next = ci->next;
+	if(next == nullptr)
 	{
-		HashCombine(hash, isfloat);
-		if(isfloat)
-		{
-			HashCombine(hash, number);
-		}
-		else
-		{
-			// Very important here, size_t may be 32bit
-			HashCombine(hash, (size_t)(integer & 0xFFFFFFFF));
-			HashCombine(hash, (size_t)((integer >> 32) & 0xFFFFFFFF));
-		}
+		next = new CallInfo();
+		next->prev = ci;
+		ci->next = next;
 	}
-	HashCombine(hash, _BKDR(str.c_str(), str.length()));
-	HashCombine(hash, table ? (size_t)table.get() : 0);
-	HashCombine(hash, state ? (size_t)state.get() : 0);
-	// Don't be stupid to hash the closure pointer
-	if(closure)
+	ci = next;
+	ci->closure = c;
+	ci->func = func;
+	ci->base = func + 1;
+	ci->pc = 0;
+	ci->nResults = nResults;
+	return ci;
+}
+
+void LuaStack::PopFrame()
+{
+	panic_cond(ci != &baseCi, "no frame to pop");
+	ci->closure = nullptr;
+	ci->varargs.clear();
+	CloseUpvalues(ci->base);
+	ci = ci->prev;
+}
+
+UpValuePtr LuaStack::FindUpvalue(int level)
+{
+	// the list is sorted, stop at the first one not above level
+	UpValuePtr* link = &openupval;
+	while(*link && (*link)->level > level)
+		link = &(*link)->next;
+	if(*link && (*link)->level == level)
+		return *link;
+
+	UpValuePtr uv = NewOpenUpValue(&slots[level], level);
+	uv->next = *link;
+	*link = uv;
+	return uv;
+}
+
+void LuaStack::CloseUpvalues(int level)
+{
+	while(openupval && openupval->level >= level)
 	{
-		if(closure->proto)
-		{
-			HashCombine(hash, (size_t)closure->proto.get());
-		}
-		else if(closure->cFunc)
-		{
-			HashCombine(hash, (size_t)closure->cFunc);
-		}
-		else
-		{
-			HashCombine(hash, 0);
-		}
+		UpValuePtr uv = openupval;
+		openupval = uv->next;
+		uv->Close();
 	}
-	return hash;
 }
 
-LuaStack::LuaStack()
+void LuaStack::_FixUpvalues()
 {
-	prev = nullptr;
-	closure = nullptr;
-	state = nullptr;
-	top = pc = 0;
+	for(UpValue* uv = openupval.get(); uv; uv = uv->next.get())
+		uv->v = &slots[uv->level];
 }
 
 // Make sure the stack has room for n elements
 void LuaStack::Check(int n)
 {
-	int free = (int)slots.size() - top;
-	for(int i = free; i < n; ++i)
+	if(top + n > (int)slots.size())
 	{
-		slots.push_back(LuaValue::NilPtr);
+		slots.resize(top + n, LuaValue::Nil);
+		_FixUpvalues();
 	}
 }
 
@@ -82,22 +104,22 @@ void LuaStack::Push(const LuaValue& value)
 	}
 	else
 	{
-		slots[top++] = NewLuaValue(value);
+		slots[top++] = value;
 	}
 }
 
-LuaValuePtr LuaStack::Pop()
+LuaValue LuaStack::Pop()
 {
-	if(top < 1)
+	if(top <= ci->base)
 	{
 		panic("stack underflow!");
-		return LuaValue::NilPtr;
+		return LuaValue::Nil;
 	}
 	else
 	{
 		--top;
-		LuaValuePtr ret = slots[top];
-		slots[top] = LuaValue::NilPtr;
+		LuaValue ret = slots[top];
+		slots[top] = LuaValue::Nil;
 		return ret;
 	}
 }
@@ -121,7 +143,7 @@ LuaValueArray LuaStack::PopN(int n)
 	vals.resize(n);
 	// Be very careful with this storage order
 	for(int i = n - 1; i >= 0; --i)
-		vals[i] = *Pop();
+		vals[i] = Pop();
 	return vals;
 }
 
@@ -140,8 +162,8 @@ int LuaStack::AbsIndex(int idx) const
 	}
 	else
 	{
-		panic_cond(top + idx >= 0, "index out of bound");
-		return idx + (int)top + 1;
+		panic_cond(top - ci->base + idx >= 0, "index out of bound");
+		return idx + (top - ci->base) + 1;
 	}
 }
 
@@ -151,13 +173,14 @@ bool LuaStack::IsValid(int idx) const
 	if(idx < LUA_REGISTRYINDEX)
 	{
 		int uvIdx = LUA_REGISTRYINDEX - idx - 1;
+		const ClosurePtr& closure = ci->closure;
 		if(closure != nullptr && uvIdx < (int)closure->upvals.size())
 			return true;
 		return false;
 	}
 
 	int absIdx = AbsIndex(idx);
-	return absIdx > 0 && absIdx <= top;
+	return absIdx > 0 && absIdx <= top - ci->base;
 }
 
 // from and to is internal index
@@ -165,9 +188,7 @@ void LuaStack::_Reverse(size_t from, size_t to)
 {
 	while(from < to)
 	{
-		LuaValuePtr temp = slots[from];
-		slots[from] = slots[to];
-		slots[to] = temp;
+		std::swap(slots[from], slots[to]);
 		++from;
 		--to;
 	}
@@ -178,9 +199,10 @@ LuaValue LuaStack::Get(int idx) const
 	if(idx < LUA_REGISTRYINDEX)
 	{
 		int uvIdx = LUA_REGISTRYINDEX - idx - 1;
+		const ClosurePtr& closure = ci->closure;
 		if(closure == nullptr || uvIdx >= (int)closure->upvals.size())
 			return LuaValue::Nil;
-		return *closure->upvals[uvIdx].val;
+		return *closure->upvals[uvIdx]->v;
 	}
 
 	if (idx == LUA_REGISTRYINDEX)
@@ -189,9 +211,9 @@ LuaValue LuaStack::Get(int idx) const
 	}
 
 	int absIdx = AbsIndex(idx);
-	if(absIdx > 0 && absIdx <= top)
+	if(absIdx > 0 && absIdx <= top - ci->base)
 	{
-		return *slots[absIdx - 1];
+		return slots[ci->base + absIdx - 1];
 	}
 	else
 	{
@@ -204,17 +226,18 @@ void LuaStack::Set(int idx, const LuaValue& value)
 	if(idx < LUA_REGISTRYINDEX)
 	{
 		int uvIdx = LUA_REGISTRYINDEX - idx - 1;
+		const ClosurePtr& closure = ci->closure;
 		if(closure != nullptr && uvIdx < (int)closure->upvals.size())
 		{
-			*closure->upvals[uvIdx].val = value;
+			closure->upvals[uvIdx]->Set(value);
 		}
 		return;
 	}
 
 	int absIdx = AbsIndex(idx);
-	if(absIdx > 0 && absIdx <= top)
+	if(absIdx > 0 && absIdx <= top - ci->base)
 	{
-		slots[absIdx - 1] = NewLuaValue(value);
+		slots[ci->base + absIdx - 1] = value;
 	}
 	else
 	{
@@ -1,149 +1,151 @@
 #include "state/lua_value.h"
 #include "state/lua_table.h"
 #include "state/api_arith.h"
-#include "vm/inst_misc.h"
-#include "vm/inst_operators.h"
-#include "vm/inst_table.h"
-#include "vm/inst_call.h"
-#include "vm/inst_upvalue.h"
+#include "state/lua_state.h"
 #include "vm/opcodes.h"
 
 String g_panic_message;
+UInt64 g_instcount = 0;
 
 const OpCode opcodes[47] =
 {
-#define MAKE_OP_CODE(T, A, B, C, mode, name, action) OpCode{T, A, B, C, mode, #name, action}
-	MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iABC, MOVE, __inst_misc__::move)
-	,MAKE_OP_CODE(0, 1, OpArgK, OpArgN, iABx, LOADK, __inst_misc__::loadK)
-	,MAKE_OP_CODE(0, 1, OpArgN, OpArgN, iABx, LOADKX, __inst_misc__::loadKx)
-	,MAKE_OP_CODE(0, 1, OpArgU, OpArgU, iABC, LOADBOOL, __inst_misc__::loadBool)
-	,MAKE_OP_CODE(0, 1, OpArgU, OpArgN, iABC, LOADNIL, __inst_misc__::loadNil)
-	,MAKE_OP_CODE(0, 1, OpArgU, OpArgN, iABC, GETUPVAL, __upvalue_inst__::getUpVal)
-	,MAKE_OP_CODE(0, 1, OpArgU, OpArgK, iABC, GETTABUP, __upvalue_inst__::getTabUp)
-	,MAKE_OP_CODE(0, 1, OpArgR, OpArgK, iABC, GETTABLE, __table_insts__::getTable)
-	,MAKE_OP_CODE(0, 0, OpArgK, OpArgK, iABC, SETTABUP, __upvalue_inst__::setTabUp)
-	,MAKE_OP_CODE(0, 0, OpArgU, OpArgN, iABC, SETUPVAL, __upvalue_inst__::setUpVal)
-	,MAKE_OP_CODE(0, 0, OpArgK, OpArgK, iABC, SETTABLE, __table_insts__::setTable)
-	,MAKE_OP_CODE(0, 1, OpArgU, OpArgU, iABC, NEWTABLE, __table_insts__::newTable)
-	,MAKE_OP_CODE(0, 1, OpArgR, OpArgK, iABC, SELF, __call_insts__::self)
-	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, ADD, __binary_insts__::add)
-	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, SUB, __binary_insts__::sub)
-	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, MUL, __binary_insts__::mul)
-	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, MOD, __binary_insts__::mod)
-	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, POW, __binary_insts__::pow)
-	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, DIV, __binary_insts__::div)
-	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, IDIV, __binary_insts__::idiv)
-	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, BAND, __binary_insts__::band)
-	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, BOR, __binary_insts__::bor)
-	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, BXOR, __binary_insts__::bxor)
-	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, SHL, __binary_insts__::shl)
-	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, SHR, __binary_insts__::shr)
-	,MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iABC, UNM, __binary_insts__::unm)
-	,MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iABC, BNOT, __binary_insts__::bnot)
-	,MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iABC, NOT, __other_insts__::_not)
-	,MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iABC, LEN, __str_insts__::length)
-	,MAKE_OP_CODE(0, 1, OpArgR, OpArgR, iABC, CONCAT, __str_insts__::cat)
-	,MAKE_OP_CODE(0, 0, OpArgR, OpArgN, iAsBx, JMP, __inst_misc__::jmp)
-	,MAKE_OP_CODE(1, 0, OpArgK, OpArgK, iABC, EQ, __compare_insts__::eq)
-	,MAKE_OP_CODE(1, 0, OpArgK, OpArgK, iABC, LT, __compare_insts__::lt)
-	,MAKE_OP_CODE(1, 0, OpArgK, OpArgK, iABC, LE, __compare_insts__::le)
-	,MAKE_OP_CODE(1, 0, OpArgN, OpArgU, iABC, TEST, __other_insts__::test)
-	,MAKE_OP_CODE(1, 1, OpArgR, OpArgU, iABC, TESTSET, __other_insts__::testSet)
-	,MAKE_OP_CODE(0, 1, OpArgU, OpArgU, iABC, CALL, __call_insts__::call)
-	,MAKE_OP_CODE(0, 1, OpArgU, OpArgU, iABC, TAILCALL, __call_insts__::tailCall)
-	,MAKE_OP_CODE(0, 0, OpArgU, OpArgN, iABC, RETURN, __call_insts__::_return)
-	,MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iAsBx, FORLOOP, __other_insts__::forLoop)
-	,MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iAsBx, FORPREP, __other_insts__::forPrep)
-	,MAKE_OP_CODE(0, 0, OpArgN, OpArgU, iABC, TFORCALL, __call_insts__::tForCall)
-	,MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iAsBx, TFORLOOP, __call_insts__::tForLoop)
-	,MAKE_OP_CODE(0, 0, OpArgU, OpArgU, iABC, SETLIST, __table_insts__::setList)
-	,MAKE_OP_CODE(0, 1, OpArgU, OpArgN, iABx, CLOSURE, __call_insts__::closure)
-	,MAKE_OP_CODE(0, 1, OpArgU, OpArgN, iABC, VARARG, __call_insts__::vararg)
-	,MAKE_OP_CODE(0, 0, OpArgU, OpArgU, iAx, EXTRAARG, nullptr)
+#define MAKE_OP_CODE(T, A, B, C, mode, name) OpCode{T, A, B, C, mode, #name}
+	MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iABC, MOVE)
+	,MAKE_OP_CODE(0, 1, OpArgK, OpArgN, iABx, LOADK)
+	,MAKE_OP_CODE(0, 1, OpArgN, OpArgN, iABx, LOADKX)
+	,MAKE_OP_CODE(0, 1, OpArgU, OpArgU, iABC, LOADBOOL)
+	,MAKE_OP_CODE(0, 1, OpArgU, OpArgN, iABC, LOADNIL)
+	,MAKE_OP_CODE(0, 1, OpArgU, OpArgN, iABC, GETUPVAL)
+	,MAKE_OP_CODE(0, 1, OpArgU, OpArgK, iABC, GETTABUP)
+	,MAKE_OP_CODE(0, 1, OpArgR, OpArgK, iABC, GETTABLE)
+	,MAKE_OP_CODE(0, 0, OpArgK, OpArgK, iABC, SETTABUP)
+	,MAKE_OP_CODE(0, 0, OpArgU, OpArgN, iABC, SETUPVAL)
+	,MAKE_OP_CODE(0, 0, OpArgK, OpArgK, iABC, SETTABLE)
+	,MAKE_OP_CODE(0, 1, OpArgU, OpArgU, iABC, NEWTABLE)
+	,MAKE_OP_CODE(0, 1, OpArgR, OpArgK, iABC, SELF)
+	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, ADD)
+	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, SUB)
+	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, MUL)
+	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, MOD)
+	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, POW)
+	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, DIV)
+	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, IDIV)
+	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, BAND)
+	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, BOR)
+	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, BXOR)
+	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, SHL)
+	,MAKE_OP_CODE(0, 1, OpArgK, OpArgK, iABC, SHR)
+	,MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iABC, UNM)
+	,MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iABC, BNOT)
+	,MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iABC, NOT)
+	,MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iABC, LEN)
+	,MAKE_OP_CODE(0, 1, OpArgR, OpArgR, iABC, CONCAT)
+	,MAKE_OP_CODE(0, 0, OpArgR, OpArgN, iAsBx, JMP)
+	,MAKE_OP_CODE(1, 0, OpArgK, OpArgK, iABC, EQ)
+	,MAKE_OP_CODE(1, 0, OpArgK, OpArgK, iABC, LT)
+	,MAKE_OP_CODE(1, 0, OpArgK, OpArgK, iABC, LE)
+	,MAKE_OP_CODE(1, 0, OpArgN, OpArgU, iABC, TEST)
+	,MAKE_OP_CODE(1, 1, OpArgR, OpArgU, iABC, TESTSET)
+	,MAKE_OP_CODE(0, 1, OpArgU, OpArgU, iABC, CALL)
+	,MAKE_OP_CODE(0, 1, OpArgU, OpArgU, iABC, TAILCALL)
+	,MAKE_OP_CODE(0, 0, OpArgU, OpArgN, iABC, RETURN)
+	,MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iAsBx, FORLOOP)
+	,MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iAsBx, FORPREP)
+	,MAKE_OP_CODE(0, 0, OpArgN, OpArgU, iABC, TFORCALL)
+	,MAKE_OP_CODE(0, 1, OpArgR, OpArgN, iAsBx, TFORLOOP)
+	,MAKE_OP_CODE(0, 0, OpArgU, OpArgU, iABC, SETLIST)
+	,MAKE_OP_CODE(0, 1, OpArgU, OpArgN, iABx, CLOSURE)
+	,MAKE_OP_CODE(0, 1, OpArgU, OpArgN, iABC, VARARG)
+	,MAKE_OP_CODE(0, 0, OpArgU, OpArgU, iAx, EXTRAARG)
 #undef MAKE_OP_CODE
 };
 
+// Also called directly by the fast paths of the arithmetic opcodes.
+// Integer arithmetic wraps around like in Lua.
 struct __funcs__
 {
-	static Int64 iadd(Int64 a, Int64 b) { return a + b; }
+	static Int64 iadd(Int64 a, Int64 b) { return (Int64)((UInt64)a + (UInt64)b); }
 	static Float64 fadd(Float64 a, Float64 b) { return a + b; }
-	static Int64 isub(Int64 a, Int64 b) { return a - b; }
+	static Int64 isub(Int64 a, Int64 b) { return (Int64)((UInt64)a - (UInt64)b); }
 	static Float64 fsub(Float64 a, Float64 b) { return a - b; }
-	static Int64 imul(Int64 a, Int64 b) { return a * b; }
+	static Int64 imul(Int64 a, Int64 b) { return (Int64)((UInt64)a * (UInt64)b); }
 	static Float64 fmul(Float64 a, Float64 b) { return a * b; }
-	static Int64 imod(Int64 a, Int64 b) { return IMod(a, b); }
+	static Int64 imod(Int64 a, Int64 b)
+	{
+		if(b == 0)
+			panic("attempt to perform 'n%0'");
+		// the smallest integer % -1 would overflow
+		return b == -1 ? 0 : IMod(a, b);
+	}
 	static Float64 fmod(Float64 a, Float64 b) { return FMod(a, b); }
 	static Float64 pow(Float64 a, Float64 b) { return ::pow(a, b); }
 	static Float64 div(Float64 a, Float64 b) { return a / b; }
-	static Int64 iidiv(Int64 a, Int64 b) { return IFloorDiv(a, b); }
+	static Int64 iidiv(Int64 a, Int64 b)
+	{
+		if(b == 0)
+			panic("attempt to perform 'n//0'");
+		return b == -1 ? isub(0, a) : IFloorDiv(a, b);
+	}
 	static Float64 fidiv(Float64 a, Float64 b) { return FFloorDiv(a, b); }
 	static Int64 band(Int64 a, Int64 b) { return a & b; }
 	static Int64 bor(Int64 a, Int64 b) { return a | b; }
 	static Int64 bxor(Int64 a, Int64 b) { return a ^ b; }
 	static Int64 shl(Int64 a, Int64 b) { return ShiftLeft(a, b); }
 	static Int64 shr(Int64 a, Int64 b) { return ShiftRight(a, b); }
-	static Int64 iunm(Int64 a, Int64) { return -a; }
+	static Int64 iunm(Int64 a, Int64) { return isub(0, a); }
 	static Float64 funm(Float64 a, Float64) { return -a; }
 	static Int64 bnot(Int64 a, Int64) { return ~a; }
 };
 
 const Operator operators[14] =
 {
-	Operator{"__add", __funcs__::iadd, __funcs__::fadd},
-	Operator{"__sub", __funcs__::isub, __funcs__::fsub},
-	Operator{"__mul",__funcs__::imul, __funcs__::fmul},
-	Operator{"__mod", __funcs__::imod, __funcs__::fmod},
-	Operator{"__pow", nullptr, __funcs__::pow},
-	Operator{"__div", nullptr, __funcs__::div},
-	Operator{"__idiv", __funcs__::iidiv, __funcs__::fidiv},
-	Operator{"__band", __funcs__::band, nullptr},
-	Operator{"__bor", __funcs__::bor, nullptr},
-	Operator{"__bxor", __funcs__::bxor, nullptr},
-	Operator{"__shl", __funcs__::shl, nullptr},
-	Operator{"__shr", __funcs__::shr, nullptr},
-	Operator{"__unm", __funcs__::iunm, __funcs__::funm},
-	Operator{"__bnot", __funcs__::bnot, nullptr},
+	Operator{TM_ADD, __funcs__::iadd, __funcs__::fadd},
+	Operator{TM_SUB, __funcs__::isub, __funcs__::fsub},
+	Operator{TM_MUL,__funcs__::imul, __funcs__::fmul},
+	Operator{TM_MOD, __funcs__::imod, __funcs__::fmod},
+	Operator{TM_POW, nullptr, __funcs__::pow},
+	Operator{TM_DIV, nullptr, __funcs__::div},
+	Operator{TM_IDIV, __funcs__::iidiv, __funcs__::fidiv},
+	Operator{TM_BAND, __funcs__::band, nullptr},
+	Operator{TM_BOR, __funcs__::bor, nullptr},
+	Operator{TM_BXOR, __funcs__::bxor, nullptr},
+	Operator{TM_SHL, __funcs__::shl, nullptr},
+	Operator{TM_SHR, __funcs__::shr, nullptr},
+	Operator{TM_UNM, __funcs__::iunm, __funcs__::funm},
+	Operator{TM_BNOT, __funcs__::bnot, nullptr},
 };
 
-void Instruction::Execute(LuaVM *vm)
-{
-	OpCode::Func action = opcodes[Opcode()].action;
-	if(action)
-		action(*this, vm);
-	else
-		warning(OpName().c_str());
-}
-
 void SetMetatable(LuaValue& val, LuaTablePtr mt, LuaState* ls)
 {
 	if(val.IsTable())
 	{
-		DEBUG_PRINT("SetMetatable: 0x%x 0x%x\n", (size_t)val.table.get(), (size_t)mt.get());
-		val.table->metatable = mt;
+		DEBUG_PRINT("SetMetatable: 0x%x 0x%x\n", (size_t)val.AsTable(), (size_t)mt.get());
+		val.AsTable()->metatable = mt;
+		g_gc.Barrier(val.AsTable());
 		return;
 	}
 	String key = Format::FormatString("_MT%d", val.tag);
-	ls->registry->Put(LuaValue(key), LuaValue(mt));
+	ls->registry->Put(LuaValue(key), mt ? LuaValue(mt) : LuaValue::Nil);
 }
 
 LuaTablePtr GetMetatable(const LuaValue& val, const LuaState* ls)
 {
 	if(val.IsTable())
 	{
-		DEBUG_PRINT("GetMetatable: 0x%x\n", (size_t)val.table.get());
-		return val.table->metatable;
+		DEBUG_PRINT("GetMetatable: 0x%x\n", (size_t)val.AsTable());
+		return val.AsTable()->metatable;
 	}
 	String key = Format::FormatString("_MT%d", val.tag);
-	LuaValuePtr mt = ls->registry->Get(LuaValue(key));
-	if(mt && mt->IsTable())
+	const LuaValue& mt = ls->registry->Get(LuaValue(key));
+	if(mt.IsTable())
 	{
-		return mt->table;
+		return mt.AsTable();
 	}
 	return nullptr;
 }
 
 std::tuple<LuaValue, bool> CallMetamethod(const LuaValue& a, const LuaValue& b,
-		const String& mmName, LuaState* ls)
+		TMS mmName, LuaState* ls)
 {
 	LuaValue mm;
 	mm = ::GetMetafield(a, mmName, ls);
@@ -157,15 +159,15 @@ std::tuple<LuaValue, bool> CallMetamethod(const LuaValue& a, const LuaValue& b,
 	ls->stack->Push(a);
 	ls->stack->Push(b);
 	ls->Call(2, 1);
-	return std::make_tuple(*ls->stack->Pop(), true);
+	return std::make_tuple(ls->stack->Pop(), true);
 }
 
-LuaValue GetMetafield(const LuaValue& val, const String& fieldName, const LuaState* ls)
+LuaValue GetMetafield(const LuaValue& val, TMS event, const LuaState* ls)
 {
 	LuaTablePtr mt = GetMetatable(val, ls);
 	if(mt)
 	{
-		return *mt->Get(LuaValue(fieldName));
+		return mt->GetMetamethod(event);
 	}
 	return LuaValue::Nil;
 }
@@ -176,11 +178,17 @@ LuaState::LuaState()
 	registry = nullptr;
 
 	coStatus = 0;
+	g_gc.threads.push_back(this);
+}
+
+LuaState::~LuaState()
+{
+	g_gc.RemoveThread(this);
 }
 
 int LuaState::GetTop() const
 {
-	return (int)stack->top;
+	return stack->top - stack->ci->base;
 }
 
 int LuaState::AbsIndex(int idx) const
@@ -215,7 +223,7 @@ void LuaState::PushValue(int idx)
 // Pop the value from the top, and set it back the stack by the index(so the index should be > 0)
 void LuaState::Replace(int idx)
 {
-	LuaValue val = *stack->Pop();
+	LuaValue val = stack->Pop();
 	stack->Set(idx, val);
 }
 
@@ -234,7 +242,7 @@ t is the ending index, and shifted to the left by n units ==> r(p, p + n - 1), r
 void LuaState::Rotate(int idx, int n)
 {
 	size_t t = stack->top - 1;
-	size_t p = stack->AbsIndex(idx) - 1;
+	size_t p = stack->ci->base + stack->AbsIndex(idx) - 1;
 	size_t m = (n >= 0) ? (t - n) : (p - n - 1);
 	stack->_Reverse(p, m);
 	stack->_Reverse(m + 1, t);
@@ -244,12 +252,12 @@ void LuaState::Rotate(int idx, int n)
 // Set capacity of the stack(idx means the capacity)
 void LuaState::SetTop(int idx)
 {
-	size_t newTop = stack->AbsIndex(idx);
+	int newTop = stack->AbsIndex(idx);
 	if(newTop < 0)
 	{
 		panic("stack underflow");
 	}
-	int n = (int)stack->top - (int)newTop;
+	int n = GetTop() - newTop;
 	if(n > 0)
 	{
 		for(int i = 0; i < n; ++i)
@@ -279,6 +287,7 @@ void LuaState::PushBoolean(bool b) { stack->Push(LuaValue(b)); }
 void LuaState::PushInteger(Int64 n) { stack->Push(LuaValue(n)); }
 void LuaState::PushNumber(Float64 n) { stack->Push(LuaValue(n)); }
 void LuaState::PushString(const String& str){ stack->Push(LuaValue(str)); }
+void LuaState::PushString(String&& str){ stack->Push(LuaValue(std::move(str))); }
 
 LuaType LuaState::Type(int idx) const
 {
@@ -318,8 +327,9 @@ bool LuaState::IsString(int idx) const
 
 void* LuaState::ToPointer(int idx) const
 {
-	if(idx < (int)stack->slots.size())
-		return stack->slots[idx].get();
+	LuaValue val = stack->Get(idx);
+	if(val.IsCollectable())
+		return val.gc;
 	return NULL;
 }
 
@@ -358,16 +368,13 @@ std::tuple<String, bool> LuaState::ToStringX(int idx)
 	LuaValue val = stack->Get(idx);
 	switch(val.tag)
 	{
-		case LUA_TSTRING: return std::make_tuple(val.str, true);
+		case LUA_TSTRING: return std::make_tuple(val.AsString(), true);
 		case LUA_TNUMBER:
 		{
-			std::tuple<String, bool> ret;
-			if(val.isfloat)
-				ret = std::make_tuple(std::to_string(val.number), true);
-			else
-				ret = std::make_tuple(std::to_string(val.integer), true);
-			stack->Set(idx, LuaValue(std::get<0>(ret)));
-			return ret;
+			char buf[MAXNUMBER2STR];
+			String s(buf, NumberToChars(val, buf));
+			stack->Set(idx, LuaValue(s));
+			return std::make_tuple(s, true);
 		}
 		default: return std::make_tuple("", false);
 	}
@@ -381,28 +388,28 @@ String LuaState::ToString(int idx)
 
 void LuaState::Arith(ArithOp op)
 {
-	LuaValue b = *stack->Pop();
+	LuaValue b = stack->Pop();
 	LuaValue a;
 	if(op != LUA_OPUNM && op != LUA_OPBNOT)
-		a = *stack->Pop();
+		a = stack->Pop();
 	else
 		a = b;
-	Operator operaotr = operators[op];
+	LuaValue res = _ArithValue(a, b, op);
+	stack->Push(res);
+}
+
+LuaValue LuaState::_ArithValue(const LuaValue& a, const LuaValue& b, ArithOp op)
+{
+	const Operator& operaotr = operators[op];
 	LuaValue res = _Arith(a, b, operaotr);
 	if(res != LuaValue::Nil)
-	{
-		stack->Push(res);
-		return;
-	}
+		return res;
 	// Call method only if value can not be converted into number
-	const String& mm = operaotr.metamethod;
-	auto metaRes = CallMetamethod(a, b, mm, this);
+	auto metaRes = CallMetamethod(a, b, operaotr.metamethod, this);
 	if(std::get<1>(metaRes))
-	{
-		stack->Push(std::get<0>(metaRes));
-		return;
-	}
+		return std::get<0>(metaRes);
 	panic("arithmetic error!");
+	return LuaValue::Nil;
 }
 
 bool LuaState::Compare(int idx1, int idx2, CompareOp op)
@@ -428,68 +435,87 @@ bool LuaState::RawEqual(int idx1, int idx2)
 void LuaState::Len(int idx)
 {
 	LuaValue val = stack->Get(idx);
+	LuaValue res = _LenValue(val);
+	stack->Push(res);
+}
+
+LuaValue LuaState::_LenValue(const LuaValue& val)
+{
 	if(val.IsString())
-		stack->Push(LuaValue((Int64)val.str.length()));
-	else
-	{
-		auto metaRes = CallMetamethod(val, val, "__len", this);
-		if(std::get<1>(metaRes))
-		{
-			stack->Push(std::get<0>(metaRes));
-		}
-		else if(val.IsTable())
-		{
-			stack->Push(LuaValue((Int64)val.table->Len()));
-		}
-		else
-		{
-			panic("length error!");
-		}
-	}
+		return LuaValue((Int64)val.AsString().length());
+	auto metaRes = CallMetamethod(val, val, TM_LEN, this);
+	if(std::get<1>(metaRes))
+		return std::get<0>(metaRes);
+	if(val.IsTable())
+		return LuaValue((Int64)val.AsTable()->Len());
+	panic("length error!");
+	return LuaValue::Nil;
 }
 
 int LuaState::RawLen(int idx)
 {
 	LuaValue val = stack->Get(idx);
 	if(val.IsString())
-		return (int)val.str.length();
+		return (int)val.AsString().length();
 	else if(val.IsTable())
-		return (int)val.table->Len();
+		return (int)val.AsTable()->Len();
 	else
 		return 0;
 }
 
+static inline bool _IsConcatable(const LuaValue& v)
+{
+	return v.tag == LUA_TSTRING || v.tag == LUA_TNUMBER;
+}
+
+// Right to left like Lua: the longest run of strings and numbers on the top is joined
+// at once into a buffer sized up front, anything else goes pairwise through __concat
 void LuaState::Concat(int n)
 {
 	if(n == 0)
 	{
 		stack->Push(LuaValue(""));
+		return;
 	}
-	else if(n > 1)
+	std::vector<LuaValue>& slots = stack->slots;
+	while(n > 1)
 	{
-		for(int i = 1; i < n; ++i)
+		int top = stack->top;
+		if(!_IsConcatable(slots[top - 2]) || !_IsConcatable(slots[top - 1]))
 		{
-			if(IsString(-1) && IsString(-2))
-			{
-				String s1 = ToString(-2);
-				String s2 = ToString(-1);
-				stack->Pop();
-				stack->Pop();
-				stack->Push(LuaValue(s1 + s2));
-				continue;
-			}
-
-			LuaValue b = *stack->Pop();
-			LuaValue a = *stack->Pop();
-			auto metaRes = CallMetamethod(a, b, "__concat", this);
-			if(std::get<1>(metaRes))
-			{
-				stack->Push(std::get<0>(metaRes));
-				continue;
-			}
+			LuaValue b = stack->Pop();
+			LuaValue a = stack->Pop();
+			auto metaRes = CallMetamethod(a, b, TM_CONCAT, this);
+			if(!std::get<1>(metaRes))
+				panic("concatenation error!");
+			stack->Push(std::get<0>(metaRes));
+			--n;
+			continue;
+		}
 
-			panic("concatenation error!");
+		int run = 2;
+		while(run < n && _IsConcatable(slots[top - run - 1]))
+			++run;
+		int first = top - run;
+		// numbers are usually short, the buffer grows if they are not
+		size_t len = 0;
+		for(int i = first; i < top; ++i)
+			len += slots[i].IsString() ? slots[i].AsString().length() : 24;
+		String s;
+		s.reserve(len);
+		char buf[MAXNUMBER2STR];
+		for(int i = first; i < top; ++i)
+		{
+			if(slots[i].IsString())
+				s += slots[i].AsString();
+			else
+				s.append(buf, NumberToChars(slots[i], buf));
 		}
+		for(int i = first + 1; i < top; ++i)
+			slots[i] = LuaValue::Nil;
+		stack->top = first + 1;
+		slots[first] = LuaValue(std::move(s));
+		n -= run - 1;
 	}
 	// n == 1, do nothing
 }
@@ -537,36 +563,40 @@ void LuaState::NewTable()
 }
 
 LuaType LuaState::_GetTable(const LuaValue& t, const LuaValue& k, bool raw)
+{
+	LuaValue v = _GetTableValue(t, k, raw);
+	stack->Push(v);
+	return v.tag;
+}
+
+LuaValue LuaState::_GetTableValue(const LuaValue& t, const LuaValue& k, bool raw)
 {
 	if(t.IsTable())
 	{
-		LuaValue v = *t.table->Get(k);
-		if(raw || v != LuaValue::Nil || !t.table->HasMetafield("__index"))
-		{
-			stack->Push(v);
-			return v.tag;
-		}
+		const LuaValue& v = t.AsTable()->Get(k);
+		if(raw || v.tag != LUA_TNIL || !t.AsTable()->HasMetafield(TM_INDEX))
+			return v;
 	}
 
 	if(!raw)
 	{
-		LuaValue mf = ::GetMetafield(t, "__index", this);
+		LuaValue mf = ::GetMetafield(t, TM_INDEX, this);
 		if(mf != LuaValue::Nil)
 		{
 			switch (mf.tag)
 			{
 				case LUA_TTABLE:
 				{
-					return _GetTable(mf, k, false);
+					return _GetTableValue(mf, k, false);
 				}
 				case LUA_TFUNCTION:
 				{
+					stack->Check(3);
 					stack->Push(mf);
 					stack->Push(t);
 					stack->Push(k);
 					Call(2, 1);
-					LuaValue v = stack->Get(-1);
-					return v.tag;
+					return stack->Pop();
 				}
 				default:
 					break;
@@ -575,13 +605,38 @@ LuaType LuaState::_GetTable(const LuaValue& t, const LuaValue& k, bool raw)
 	}
 
 	panic("index error!");
-	return LUA_TNONE;
+	return LuaValue::Nil;
+}
+
+// _GetTableValue for a constant string key. The key of the table itself and one inherited
+// through an __index table are found from the slots in ic, everything else takes the generic path.
+LuaValue LuaState::_GetTableValueCached(const LuaValue& t, const LuaValue& k, InlineCache& ic)
+{
+	if(t.IsTable())
+	{
+		LuaTable* tbl = t.AsTable();
+		const LuaValue& v = tbl->GetStr(k, ic.slot);
+		if(v.tag != LUA_TNIL || !tbl->metatable)
+			return v;
+		const LuaValue& index = tbl->metatable->GetMetamethod(TM_INDEX, ic.indexSlot);
+		if(index.tag == LUA_TNIL)
+			return LuaValue::Nil;
+		if(index.IsTable())
+		{
+			LuaTable* base = index.AsTable();
+			const LuaValue& inherited = base->GetStr(k, ic.inheritedSlot);
+			if(inherited.tag != LUA_TNIL || !base->metatable)
+				return inherited;
+			return _GetTableValue(index, k, false);
+		}
+	}
+	return _GetTableValue(t, k, false);
 }
 
 LuaType LuaState::GetTable(int idx)
 {
 	LuaValue t = stack->Get(idx);
-	LuaValue k = *stack->Pop();
+	LuaValue k = stack->Pop();
 	return _GetTable(t, k, false);
 }
 
@@ -606,7 +661,7 @@ LuaType LuaState::GetI(int idx, Int64 k)
 LuaType LuaState::RawGet(int idx)
 {
 	LuaValue t = stack->Get(idx);
-	LuaValue k = *stack->Pop();
+	LuaValue k = stack->Pop();
 	return _GetTable(t, k, true);
 }
 
@@ -620,17 +675,17 @@ void LuaState::_SetTable(const LuaValue& t, const LuaValue& k, const LuaValue& v
 {
 	if(t.IsTable())
 	{
-		LuaTablePtr tbl = t.table;
-		if(raw || *tbl->Get(k) != LuaValue::Nil || !tbl->HasMetafield("__newindex"))
+		LuaTablePtr tbl = t.AsTable();
+		if(raw || tbl->Get(k).tag != LUA_TNIL || !tbl->HasMetafield(TM_NEWINDEX))
 		{
-			t.table->Put(k, v);
+			t.AsTable()->Put(k, v);
 			return;
 		}
 	}
 
 	if(!raw)
 	{
-		LuaValue mf = ::GetMetafield(t, "__newindex", this);
+		LuaValue mf = ::GetMetafield(t, TM_NEWINDEX, this);
 		if(mf != LuaValue::Nil)
 		{
 			switch (mf.tag)
@@ -641,6 +696,7 @@ void LuaState::_SetTable(const LuaValue& t, const LuaValue& k, const LuaValue& v
 				}
 				case LUA_TFUNCTION:
 				{
+					stack->Check(4);
 					stack->Push(mf);
 					stack->Push(t);
 					stack->Push(k);
@@ -657,209 +713,727 @@ void LuaState::_SetTable(const LuaValue& t, const LuaValue& k, const LuaValue& v
 	panic("index error!");
 }
 
+// _SetTable for a constant string key, a key already in the table is assigned
+// in its cached slot since __newindex does not apply to it
+void LuaState::_SetTableCached(const LuaValue& t, const LuaValue& k, const LuaValue& v, InlineCache& ic)
+{
+	if(t.IsTable() && t.AsTable()->ReplaceStr(k, v, ic.slot))
+		return;
+	_SetTable(t, k, v, false);
+}
+
 void LuaState::SetTable(int idx)
 {
 	LuaValue t = stack->Get(idx);
-	LuaValue v = *stack->Pop();
-	LuaValue k = *stack->Pop();
+	LuaValue v = stack->Pop();
+	LuaValue k = stack->Pop();
 	_SetTable(t, k, v, false);
 }
 
 void LuaState::SetField(int idx, const String& k)
 {
 	LuaValue t = stack->Get(idx);
-	LuaValue v = *stack->Pop();
+	LuaValue v = stack->Pop();
 	_SetTable(t, LuaValue(k), LuaValue(v), false);
 }
 
 void LuaState::SetI(int idx, Int64 i)
 {
 	LuaValue t = stack->Get(idx);
-	LuaValue v = *stack->Pop();
+	LuaValue v = stack->Pop();
 	_SetTable(t, LuaValue(i), LuaValue(v), false);
 }
 
 void LuaState::RawSet(int idx)
 {
 	LuaValue t = stack->Get(idx);
-	LuaValue v = *stack->Pop();
-	LuaValue k = *stack->Pop();
+	LuaValue v = stack->Pop();
+	LuaValue k = stack->Pop();
 	_SetTable(t, LuaValue(k), LuaValue(v), true);
 }
 
 void LuaState::RawSetI(int idx, Int64 i)
 {
 	LuaValue t = stack->Get(idx);
-	LuaValue v = *stack->Pop();
+	LuaValue v = stack->Pop();
 	_SetTable(t, LuaValue(i), LuaValue(v), true);
 }
 
-void LuaState::PushLuaStack(LuaStackPtr s)
+bool LuaState::IsBinaryChunk(const Byte* chunk, size_t size)
 {
-	s->prev = stack;
-	stack = s;
+	return size >= sizeof(LUA_SIGNATURE) && memcmp(chunk, LUA_SIGNATURE, sizeof(LUA_SIGNATURE)) == 0;
 }
 
-void LuaState::PopLuaStack()
-{
-	LuaStackPtr s = stack;
-	stack = stack->prev;
-	s->prev = nullptr;
-}
+ChunkCache g_chunkcache;
 
-bool LuaState::IsBinaryChunk(const ByteArray& chunk)
+int LuaState::Load(const Byte* chunk, size_t size, const String& chunkName, const String& mode)
 {
-	if(chunk.size() >= 4)
+	PrototypePtr proto = nullptr;
+	// a malformed binary chunk or a syntax error is a load error, not an escape to the host
+	try
+	{
+		if(IsBinaryChunk(chunk, size))
+		{
+			proto = Undump(chunk, size);
+		}
+		else
+		{
+			proto = g_chunkcache.Load(chunk, size, chunkName);
+		}
+	}
+	catch (int)
 	{
-		Byte signature[4];
-		static_assert(sizeof(signature) == sizeof(UInt32), "size check");
-		memcpy(signature, chunk.data(), sizeof(signature));
-		return memcmp(signature, LUA_SIGNATURE, sizeof(signature)) == 0;
+		stack->Check(1);
+		stack->Push(LuaValue(g_panic_message));
+		return LUA_ERRSYNTAX;
 	}
-	return false;
+	ClosurePtr closure = NewLuaClosure(proto);
+	stack->Push(LuaValue(closure));
+	// the first upvalue is _ENV, a dumped function may have more and they start as nil
+	for(size_t i = 0; i < closure->upvals.size(); ++i)
+	{
+		closure->upvals[i] = NewClosedUpValue(i == 0 ? registry->GetInt(LUA_RIDX_GLOBALS) : LuaValue::Nil);
+	}
+	return LUA_OK;
 }
 
-int LuaState::Load(const ByteArray& chunk, const String& chunkName, const String& mode)
+int LuaState::Dump(ByteArray& chunk, bool strip)
 {
-	PrototypePtr proto = nullptr;
-	if(IsBinaryChunk(chunk))
-	{
-		proto = Undump(chunk);
-	}
-	else
+	PrototypePtr proto = ToProto(-1);
+	if(proto == nullptr)
+		return 1;
+	chunk = ::Dump(proto.get(), strip);
+	return 0;
+}
+
+// The limit of a loop with an integer start and step as an integer, floored or ceiled
+// toward the start and clipped to the integer range. False when the loop can't run.
+static bool _ForLimit(const LuaValue& limit, Int64 step, Int64& result)
+{
+	if(!limit.IsFloat64())
 	{
-		String strChunk;
-		strChunk.reserve(chunk.size());
-		for(Byte ch : chunk)
+		auto iRes = ConvertToInteger(limit);
+		if(std::get<1>(iRes))
 		{
-			strChunk += ch;
+			result = std::get<0>(iRes);
+			return true;
 		}
-		proto = Compile(strChunk, chunkName);
 	}
-	ClosurePtr closure = NewLuaClosure(proto);
-	stack->Push(LuaValue(closure));
-	if(proto->Upvalues.size() > 0)
+	auto fRes = ConvertToFloat(limit);
+	panic_cond(std::get<1>(fRes), "'for' limit must be a number");
+	Float64 f = step < 0 ? ceil(std::get<0>(fRes)) : floor(std::get<0>(fRes));
+	if(f >= -9223372036854775808.0 && f < 9223372036854775808.0)
 	{
-		LuaValuePtr env = registry->Get(LuaValue(LUA_RIDX_GLOBALS));
-		closure->upvals[0] = UpValue(env);
+		result = (Int64)f;
+		return true;
 	}
-	return LUA_OK;
+	// NaN ends up below every integer
+	if(f > 0)
+	{
+		result = 0x7FFFFFFFFFFFFFFFLL;
+		return step >= 0;
+	}
+	result = -0x7FFFFFFFFFFFFFFFLL - 1;
+	return step < 0;
 }
 
-void LuaState::RunLuaClosure()
+// Sets up R(A)..R(A+3) of a numeric for and tells whether the body runs at least once.
+// With an integer start and step the limit slot becomes the count of iterations left after
+// the first one, FORLOOP then only counts it down. Otherwise the three values become floats.
+// A zero step counts as ascending and loops for good.
+static bool _ForPrep(LuaValue* ra)
 {
-	DEBUG_PRINT("Run Lua Closure");
-	while(true)
+	if(ra[0].IsInt64() && ra[2].IsInt64())
 	{
-		Instruction inst = Instruction(Fetch());
-#if DEBUG_PRINT_ENABLE
-		LuaStackPtr counter = stack;
-		int depth = 0;
-		while (counter->prev)
+		Int64 init = ra[0].integer;
+		Int64 step = ra[2].integer;
+		Int64 limit = 0;
+		if(!_ForLimit(ra[1], step, limit))
+			return false;
+		UInt64 count = 0;
+		if(step >= 0)
+		{
+			if(init > limit)
+				return false;
+			count = step == 0 ? ~0ULL : ((UInt64)limit - (UInt64)init) / (UInt64)step;
+		}
+		else
 		{
-			++depth;
-			counter = counter->prev;
+			if(init < limit)
+				return false;
+			// step + 1 avoids negating the smallest integer
+			count = ((UInt64)init - (UInt64)limit) / ((UInt64)(-(step + 1)) + 1);
 		}
-		for (int i = 0; i < depth * 5; ++i)
-			printf("(");
-		printf("thread:0x%x stack:0x%x pc:%d\n", (size_t)this, (size_t)stack.get(), stack->pc - 1);
-		puts("----------Stack Before Execution----------");
-		PrintStack(*this);
-		puts("----------Stack Before Execution----------");
-		DEBUG_PRINT("%s", inst.OpName().c_str());
-		Prototype::PrintOperands(inst);
-		puts("");
+		ra[1] = LuaValue((Int64)count);
+	}
+	else
+	{
+		auto init = ConvertToFloat(ra[0]);
+		auto limit = ConvertToFloat(ra[1]);
+		auto step = ConvertToFloat(ra[2]);
+		panic_cond(std::get<1>(init), "'for' initial value must be a number");
+		panic_cond(std::get<1>(limit), "'for' limit must be a number");
+		panic_cond(std::get<1>(step), "'for' step must be a number");
+		ra[0] = LuaValue(std::get<0>(init));
+		ra[1] = LuaValue(std::get<0>(limit));
+		ra[2] = LuaValue(std::get<0>(step));
+		if(std::get<0>(step) >= 0 ? !(std::get<0>(init) <= std::get<0>(limit)) : !(std::get<0>(limit) <= std::get<0>(init)))
+			return false;
+	}
+	ra[3] = ra[0];
+	return true;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#	define LUA_USE_JUMPTABLE 1
+#else
+#	define LUA_USE_JUMPTABLE 0
 #endif
-		inst.Execute(this);
+
 #if DEBUG_PRINT_ENABLE
-		puts("----------Stack After Execution----------");
-		PrintStack(*this);
-		puts("----------Stack After Execution----------");
-		printf("thread:0x%x stack:0x%x pc:%d", (size_t)this, (size_t)stack.get(), stack->pc - 1);
-		for (int i = 0; i < depth * 5; ++i)
-			printf(")");
-		puts("");
-#endif
-		if(inst.Opcode() == OP_RETURN)
-			break;
+static void TraceInstruction(LuaState* ls, Instruction inst)
+{
+	CallInfo* counter = ls->stack->ci;
+	int depth = 0;
+	while (counter->prev)
+	{
+		++depth;
+		counter = counter->prev;
 	}
-}
+	for (int i = 0; i < depth * 5; ++i)
+		printf("(");
+	printf("thread:0x%x frame:0x%x pc:%d\n", (size_t)ls, (size_t)ls->stack->ci, ls->stack->ci->pc);
+	puts("----------Stack Before Execution----------");
+	PrintStack(*ls);
+	puts("----------Stack Before Execution----------");
+	DEBUG_PRINT("%s", inst.OpName().c_str());
+	Prototype::PrintOperands(inst);
+	puts("");
+}
+#	define vmtrace(inst) { savepc(); TraceInstruction(this, inst); }
+#else
+#	define vmtrace(inst)
+#endif
 
-void LuaState::CallLuaClosure(int nArgs, int nResults, ClosurePtr c)
+#ifdef LUA_COUNT_INSTRUCTIONS
+#	define vmcount() (++g_instcount)
+#else
+#	define vmcount()
+#endif
+
+// Everything alive is reachable from the stacks between two instructions
+#define vmfetch() { g_gc.CheckGC(); inst = Instruction(*pc++); a = inst.A(); vmcount(); vmtrace(inst); }
+// pc lives in a local, store it back before running anything that may call or yield
+#define savepc() (ci->pc = (int)(pc - code))
+#define reload() { cl = ci->closure.get(); code = cl->proto->Code.data(); k = cl->proto->K.data(); pc = code + ci->pc; \
+	ic = cl->proto->Caches.data(); base = ci->base; frameTop = base + (int)cl->proto->MaxStackSize; }
+
+// Registers of the running frame and the RK operand of an instruction
+#define REG(i) (slots[base + (i)])
+#define SETREG(i, v) (slots[base + (i)] = (v))
+#define RK(x) ((x) > 0xFF ? k[(x) & 0xFF] : REG(x))
+#define UPVAL(i) (*cl->upvals[i]->v)
+// Indexing or assigning with a constant string goes through the inline cache of the instruction
+#define vmgetfield(t, x) (((x) > 0xFF && k[(x) & 0xFF].IsString()) ? \
+	_GetTableValueCached(t, k[(x) & 0xFF], ic[pc - code - 1]) : _GetTableValue(t, RK(x), false))
+#define vmsetfield(t, x, v) { if((x) > 0xFF && k[(x) & 0xFF].IsString()) \
+	_SetTableCached(t, k[(x) & 0xFF], v, ic[pc - code - 1]); else _SetTable(t, RK(x), v, false); }
+#define vmtofloat(v) ((v).isfloat ? (v).number : (Float64)(v).integer)
+// Numbers are computed in place, two integers with ifunc and anything else with ffunc.
+// Strings and metamethods go through _ArithValue.
+#define vmarith(op, ifunc, ffunc) { \
+	const LuaValue& rb = RK(inst.B()); \
+	const LuaValue& rc = RK(inst.C()); \
+	if(rb.tag == LUA_TNUMBER && rc.tag == LUA_TNUMBER) \
+	{ \
+		if(!rb.isfloat && !rc.isfloat) \
+			SETREG(a, LuaValue(__funcs__::ifunc(rb.integer, rc.integer))); \
+		else \
+			SETREG(a, LuaValue(__funcs__::ffunc(vmtofloat(rb), vmtofloat(rc)))); \
+	} \
+	else \
+		vmarithslow(op); }
+// Operations with a float result whatever the operands
+#define vmarithf(op, ffunc) { \
+	const LuaValue& rb = RK(inst.B()); \
+	const LuaValue& rc = RK(inst.C()); \
+	if(rb.tag == LUA_TNUMBER && rc.tag == LUA_TNUMBER) \
+		SETREG(a, LuaValue(__funcs__::ffunc(vmtofloat(rb), vmtofloat(rc)))); \
+	else \
+		vmarithslow(op); }
+// Bitwise operations, floats with an integer value take the slow path
+#define vmbitwise(op, ifunc) { \
+	const LuaValue& rb = RK(inst.B()); \
+	const LuaValue& rc = RK(inst.C()); \
+	if(rb.IsInt64() && rc.IsInt64()) \
+		SETREG(a, LuaValue(__funcs__::ifunc(rb.integer, rc.integer))); \
+	else \
+		vmarithslow(op); }
+// Two integers or two floats are compared in place, the JMP that follows is skipped unless the result is A
+#define vmcompare(cmp, op) { \
+	const LuaValue& rb = RK(inst.B()); \
+	const LuaValue& rc = RK(inst.C()); \
+	bool res = false; \
+	if(rb.tag == LUA_TNUMBER && rc.tag == LUA_TNUMBER && rb.isfloat == rc.isfloat) \
+		res = rb.isfloat ? rb.number op rc.number : rb.integer op rc.integer; \
+	else \
+	{ \
+		savepc(); \
+		res = cmp(rb, rc, this, false); \
+	} \
+	if(res != (a != 0)) \
+		++pc; }
+#define vmarithslow(op) { savepc(); LuaValue v = _ArithValue(RK(inst.B()), RK(inst.C()), op); SETREG(a, v); }
+#define vmunary(op) { savepc(); LuaValue rb = REG(inst.B()); LuaValue v = _ArithValue(rb, rb, op); SETREG(a, v); }
+
+#if LUA_USE_JUMPTABLE
+#	define vmdispatch(o) goto *disptab[o];
+#	define vmcase(l) L_##l:
+#	define vmbreak vmfetch(); vmdispatch(inst.Opcode());
+#else
+#	define vmdispatch(o) switch(o)
+#	define vmcase(l) case l:
+#	define vmbreak break
+#endif
+
+// Runs the frame on the top until its RETURN and returns the slot of its first result.
+// The code has been checked by VerifyProto when it was loaded so operands are used unchecked.
+// Registers are read and written in place, stack->top stays at the end of the frame
+// except right after an instruction with a variable number of results where it marks their end.
+int LuaState::RunLuaClosure()
 {
-	int nRegs = (int)c->proto->MaxStackSize;
-	int nParams = (int)c->proto->NumParams;
-	bool isVararg = c->proto->IsVararg == 1;
+#if LUA_USE_JUMPTABLE
+#include "vm/jumptab.h"
+#endif
+	DEBUG_PRINT("Run Lua Closure");
+	std::vector<LuaValue>& slots = stack->slots;
+	CallInfo* ci = stack->ci;
+	Closure* cl;
+	const UInt32* code;
+	const LuaValue* k;
+	InlineCache* ic;
+	const UInt32* pc;
+	int base;
+	int frameTop;
+	Instruction inst(0);
+	int a;
+	reload();
+	for(;;)
+	{
+		vmfetch();
+		vmdispatch(inst.Opcode())
+		{
+			vmcase(OP_MOVE)
+			{
+				SETREG(a, REG(inst.B()));
+				vmbreak;
+			}
+			vmcase(OP_LOADK)
+			{
+				SETREG(a, k[inst.Bx()]);
+				vmbreak;
+			}
+			vmcase(OP_LOADKX)
+			{
+				int ax = Instruction(*pc++).Ax();
+				SETREG(a, k[ax]);
+				vmbreak;
+			}
+			vmcase(OP_LOADBOOL)
+			{
+				SETREG(a, LuaValue(inst.B() != 0));
+				if(inst.C())
+					++pc;
+				vmbreak;
+			}
+			vmcase(OP_LOADNIL)
+			{
+				for(int i = 0; i <= inst.B(); ++i)
+					SETREG(a + i, LuaValue::Nil);
+				vmbreak;
+			}
+			vmcase(OP_GETUPVAL)
+			{
+				SETREG(a, UPVAL(inst.B()));
+				vmbreak;
+			}
+			// A metamethod may grow the stack and move the registers,
+			// operands passed by reference and results go through locals
+			vmcase(OP_GETTABUP)
+			{
+				savepc();
+				LuaValue t = UPVAL(inst.B());
+				LuaValue v = vmgetfield(t, inst.C());
+				SETREG(a, v);
+				vmbreak;
+			}
+			vmcase(OP_GETTABLE)
+			{
+				savepc();
+				LuaValue t = REG(inst.B());
+				LuaValue v = vmgetfield(t, inst.C());
+				SETREG(a, v);
+				vmbreak;
+			}
+			vmcase(OP_SETTABUP)
+			{
+				savepc();
+				LuaValue t = UPVAL(a);
+				vmsetfield(t, inst.B(), RK(inst.C()));
+				vmbreak;
+			}
+			vmcase(OP_SETUPVAL)
+			{
+				cl->upvals[inst.B()]->Set(REG(a));
+				vmbreak;
+			}
+			vmcase(OP_SETTABLE)
+			{
+				savepc();
+				LuaValue t = REG(a);
+				vmsetfield(t, inst.B(), RK(inst.C()));
+				vmbreak;
+			}
+			vmcase(OP_NEWTABLE)
+			{
+				// sizes are encoded as "floating point bytes"
+				SETREG(a, LuaValue(NewLuaTable(Fb2int(inst.B()), Fb2int(inst.C()))));
+				vmbreak;
+			}
+			vmcase(OP_SELF)
+			{
+				savepc();
+				LuaValue obj = REG(inst.B());
+				SETREG(a + 1, obj);
+				LuaValue v = vmgetfield(obj, inst.C());
+				SETREG(a, v);
+				vmbreak;
+			}
+			vmcase(OP_ADD) { vmarith(LUA_OPADD, iadd, fadd); vmbreak; }
+			vmcase(OP_SUB) { vmarith(LUA_OPSUB, isub, fsub); vmbreak; }
+			vmcase(OP_MUL) { vmarith(LUA_OPMUL, imul, fmul); vmbreak; }
+			vmcase(OP_MOD) { vmarith(LUA_OPMOD, imod, fmod); vmbreak; }
+			vmcase(OP_POW) { vmarithf(LUA_OPPOW, pow); vmbreak; }
+			vmcase(OP_DIV) { vmarithf(LUA_OPDIV, div); vmbreak; }
+			vmcase(OP_IDIV) { vmarith(LUA_OPIDIV, iidiv, fidiv); vmbreak; }
+			vmcase(OP_BAND) { vmbitwise(LUA_OPBAND, band); vmbreak; }
+			vmcase(OP_BOR) { vmbitwise(LUA_OPBOR, bor); vmbreak; }
+			vmcase(OP_BXOR) { vmbitwise(LUA_OPBXOR, bxor); vmbreak; }
+			vmcase(OP_SHL) { vmbitwise(LUA_OPSHL, shl); vmbreak; }
+			vmcase(OP_SHR) { vmbitwise(LUA_OPSHR, shr); vmbreak; }
+			vmcase(OP_UNM)
+			{
+				const LuaValue& rb = REG(inst.B());
+				if(rb.IsInt64())
+					SETREG(a, LuaValue(__funcs__::iunm(rb.integer, 0)));
+				else if(rb.IsFloat64())
+					SETREG(a, LuaValue(-rb.number));
+				else
+					vmunary(LUA_OPUNM);
+				vmbreak;
+			}
+			vmcase(OP_BNOT)
+			{
+				const LuaValue& rb = REG(inst.B());
+				if(rb.IsInt64())
+					SETREG(a, LuaValue(~rb.integer));
+				else
+					vmunary(LUA_OPBNOT);
+				vmbreak;
+			}
+			vmcase(OP_NOT)
+			{
+				SETREG(a, LuaValue(!ConvertToBoolean(REG(inst.B()))));
+				vmbreak;
+			}
+			vmcase(OP_LEN)
+			{
+				savepc();
+				LuaValue rb = REG(inst.B());
+				LuaValue v = _LenValue(rb);
+				SETREG(a, v);
+				vmbreak;
+			}
+			vmcase(OP_CONCAT)
+			{
+				// R(B)...R(C) are temporaries, concatenate them where they are
+				int b = inst.B();
+				int c = inst.C();
+				savepc();
+				stack->top = base + c + 1;
+				Concat(c - b + 1);
+				LuaValue v = REG(b);
+				stack->top = frameTop;
+				SETREG(a, v);
+				vmbreak;
+			}
+			vmcase(OP_JMP)
+			{
+				pc += inst.sBx();
+				if(a != 0)
+					CloseUpvalues(a);
+				vmbreak;
+			}
+			vmcase(OP_EQ) { vmcompare(_eq, ==); vmbreak; }
+			vmcase(OP_LT) { vmcompare(_lt, <); vmbreak; }
+			vmcase(OP_LE) { vmcompare(_le, <=); vmbreak; }
+			vmcase(OP_TEST)
+			{
+				if(ConvertToBoolean(REG(a)) != (inst.C() != 0))
+					++pc;
+				vmbreak;
+			}
+			vmcase(OP_TESTSET)
+			{
+				const LuaValue& rb = REG(inst.B());
+				if(ConvertToBoolean(rb) == (inst.C() != 0))
+					SETREG(a, rb);
+				else
+					++pc;
+				vmbreak;
+			}
+			vmcase(OP_CALL)
+			{
+				// B == 0: the arguments end at the top left by the previous instruction
+				int b = inst.B();
+				int nResults = inst.C() - 1;
+				if(b != 0)
+					stack->top = base + a + b;
+				savepc();
+				Call(stack->top - (base + a) - 1, nResults);
+				// the results are in place from R(A), C == 0 leaves the top after the last one
+				if(nResults >= 0)
+					stack->top = frameTop;
+				vmbreak;
+			}
+			vmcase(OP_TAILCALL)
+			{
+				int b = inst.B();
+				if(b != 0)
+					stack->top = base + a + b;
+				savepc();
+				// a C function returns in place, the RETURN that follows passes its results on
+				if(TailCall(stack->top - (base + a) - 1))
+					reload();
+				vmbreak;
+			}
+			vmcase(OP_RETURN)
+			{
+				int b = inst.B();
+				if(b != 0)
+					stack->top = base + a + b - 1;
+				savepc();
+				return base + a;
+			}
+			vmcase(OP_FORLOOP)
+			{
+				// R(A), R(A+1) and R(A+2) are raw numbers set up by FORPREP
+				LuaValue* ra = &REG(a);
+				if(!ra[0].isfloat)
+				{
+					if(ra[1].integer != 0)
+					{
+						--ra[1].integer;
+						ra[0].integer = (Int64)((UInt64)ra[0].integer + (UInt64)ra[2].integer);
+						ra[3] = ra[0];
+						pc += inst.sBx();
+					}
+				}
+				else
+				{
+					Float64 step = ra[2].number;
+					Float64 idx = ra[0].number + step;
+					if(step >= 0 ? idx <= ra[1].number : ra[1].number <= idx)
+					{
+						ra[0].number = idx;
+						ra[3] = ra[0];
+						pc += inst.sBx();
+					}
+				}
+				vmbreak;
+			}
+			vmcase(OP_FORPREP)
+			{
+				savepc();
+				// The body follows FORPREP, a loop that never runs jumps past its FORLOOP
+				if(!_ForPrep(&REG(a)))
+					pc += inst.sBx() + 1;
+				vmbreak;
+			}
+			vmcase(OP_TFORCALL)
+			{
+				// R(A+3), ..., R(A+2+C) := R(A)(R(A+1), R(A+2))
+				stack->top = base + a + 3;
+				stack->Check(3);
+				for(int i = 0; i < 3; ++i)
+					SETREG(a + 3 + i, REG(a + i));
+				stack->top += 3;
+				savepc();
+				Call(2, inst.C());
+				stack->top = frameTop;
+				vmbreak;
+			}
+			vmcase(OP_TFORLOOP)
+			{
+				if(REG(a + 1).tag != LUA_TNIL)
+				{
+					SETREG(a, REG(a + 1));
+					pc += inst.sBx();
+				}
+				vmbreak;
+			}
+			vmcase(OP_SETLIST)
+			{
+				int n = inst.B();
+				int c = inst.C();
+				int batch = c > 0 ? c - 1 : Instruction(*pc++).Ax();
+				if(n == 0)
+					n = stack->top - (base + a) - 1;
+				LuaTable* t = REG(a).AsTable();
+				Int64 idx = (Int64)batch * LFIELDS_PER_FLUSH;
+				for(int i = 1; i <= n; ++i)
+					t->Put(LuaValue(idx + i), REG(a + i));
+				stack->top = frameTop;
+				vmbreak;
+			}
+			vmcase(OP_CLOSURE)
+			{
+				LuaValue v(_NewClosure(inst.Bx()));
+				SETREG(a, v);
+				vmbreak;
+			}
+			vmcase(OP_VARARG)
+			{
+				const LuaValueArray& varargs = ci->varargs;
+				int n = inst.B() - 1;
+				if(n < 0)
+				{
+					n = (int)varargs.size();
+					stack->top = base + a;
+					stack->Check(n);
+					stack->top = base + a + n;
+				}
+				for(int i = 0; i < n; ++i)
+					SETREG(a + i, i < (int)varargs.size() ? varargs[i] : LuaValue::Nil);
+				vmbreak;
+			}
+			vmcase(OP_EXTRAARG)
+			{
+				panic("unexpected EXTRAARG");
+				vmbreak;
+			}
+		}
+	}
+}
 
-	LuaStackPtr newStack = NewLuaStack(nRegs + LUA_MINSTACK, stack->state);
-	// Assign the function
-	newStack->closure = c;
+#undef vmtrace
+#undef vmcount
+#undef vmfetch
+#undef savepc
+#undef reload
+#undef REG
+#undef SETREG
+#undef RK
+#undef UPVAL
+#undef vmgetfield
+#undef vmsetfield
+#undef vmtofloat
+#undef vmarith
+#undef vmarithf
+#undef vmbitwise
+#undef vmcompare
+#undef vmarithslow
+#undef vmunary
+#undef vmdispatch
+#undef vmcase
+#undef vmbreak
+
+// Registers of a Lua call, the arguments are already in place right after ci->func
+void LuaState::_InitLuaFrame(CallInfo* ci, int nArgs, int oldTop)
+{
+	const PrototypePtr& proto = ci->closure->proto;
+	int nRegs = (int)proto->MaxStackSize;
+	int nParams = (int)proto->NumParams;
+	panic_cond(nRegs >= nParams, "nRegs is less than nParams");
 
 	// a = func(1,2,3,...)
 	// a(1,2,3,4,5) nArgs = 5, nParams = 3
 	// nArgs(which is all arguments) contains nParams(which is non varargs arguments)
-	LuaValueArray funcAndArgs = stack->PopN(nArgs + 1);
-	// Push the non varargs arguments
-	newStack->PushN(Slice(funcAndArgs, 1, (int)funcAndArgs.size()), nParams);
-	panic_cond(nRegs >= nParams, "nRegs is less than nParams");
-	newStack->top = nRegs;
-	if (nArgs > nParams && isVararg)
+	if(nArgs > nParams && proto->IsVararg == 1)
 	{
-		// Assign the varargs arguments
-		newStack->varargs = Slice(funcAndArgs, nParams + 1, (int)funcAndArgs.size());
+		ci->varargs.reserve(nArgs - nParams);
+		for(int i = nParams; i < nArgs; ++i)
+			ci->varargs.push_back(stack->slots[ci->base + i]);
 	}
 
-	PushLuaStack(newStack);
-	RunLuaClosure();
-	PopLuaStack();
+	stack->top = ci->base;
+	stack->Check(nRegs + LUA_MINSTACK);
+	// Missing parameters, the other registers and whatever was left above them start as nil
+	int end = std::max(oldTop, ci->base + nRegs);
+	for(int i = ci->base + std::min(nArgs, nParams); i < end; ++i)
+		stack->slots[i] = LuaValue::Nil;
+	stack->top = ci->base + nRegs;
+}
 
-	panic_cond(!stack->closure || stack->closure->cFunc || stack->top == stack->closure->proto->MaxStackSize,
-		"return values must locate on MaxStackSize of current call frame");
+// Move the results starting at firstResult down to the function slot and leave the frame
+void LuaState::_PostCall(int firstResult)
+{
+	CallInfo* ci = stack->ci;
+	// the results move over the registers, upvalues must take their values first
+	stack->CloseUpvalues(ci->base);
+	int res = ci->func;
+	int n = stack->top - firstResult;
+	// nResults not "n" for some ticky usage
+	int wanted = ci->nResults < 0 ? n : ci->nResults;
+	stack->Check(wanted);
 
-	if (nResults != 0)
-	{
-		// Pop the return values from the newStack
-		LuaValueArray results = newStack->PopN(newStack->top - nRegs);
-		stack->Check((int)results.size());
-		// nResults not "(int)results.size()" for some ticky usage
-		stack->PushN(results, nResults);
-	}
+	int i = 0;
+	for(; i < wanted && i < n; ++i)
+		stack->slots[res + i] = stack->slots[firstResult + i];
+	for(; i < wanted; ++i)
+		stack->slots[res + i] = LuaValue::Nil;
+	for(int j = res + wanted; j < stack->top; ++j)
+		stack->slots[j] = LuaValue::Nil;
+
+	stack->top = res + wanted;
+	stack->PopFrame();
 }
 
-void LuaState::CallCClosure(int nArgs, int nResults, ClosurePtr c)
+void LuaState::CallLuaClosure(int nArgs, int nResults, ClosurePtr c)
 {
-	LuaStackPtr newStack = NewLuaStack(nArgs + LUA_MINSTACK, stack->state);
-	newStack->closure = c;
+	int func = stack->top - nArgs - 1;
+	CallInfo* ci = stack->PushFrame(c, func, nResults);
+	_InitLuaFrame(ci, nArgs, stack->top);
 
-	LuaValueArray args = stack->PopN(nArgs);
-	newStack->PushN(args, nArgs);
-	// Throw away the C closure
-	stack->Pop();
+	int firstResult = RunLuaClosure();
+	_PostCall(firstResult);
+}
 
-	PushLuaStack(newStack);
-	int r = c->cFunc(this);
-	PopLuaStack();
+void LuaState::CallCClosure(int nArgs, int nResults, ClosurePtr c)
+{
+	int func = stack->top - nArgs - 1;
+	stack->PushFrame(c, func, nResults);
+	stack->Check(LUA_MINSTACK);
 
-	if(nResults != 0)
-	{
-		LuaValueArray results = newStack->PopN(r);
-		newStack->Check((int)results.size());
-		stack->PushN(results, nResults);
-	}
+	int r = c->cFunc(this);
+	_PostCall(stack->top - r);
 }
 
-void LuaState::Call(int nArgs, int nResults)
+// The closure to call for the value below the nArgs arguments,
+// a __call metamethod is inserted before the value which becomes the first argument
+ClosurePtr LuaState::_CallTarget(int& nArgs)
 {
 	// closure func
 	LuaValue val = stack->Get(-(nArgs + 1));
 
 	if(!val.IsClosure())
 	{
-		LuaValue mf = ::GetMetafield(val, "__call", this);
+		LuaValue mf = ::GetMetafield(val, TM_CALL, this);
 		if(mf != LuaValue::Nil)
 		{
 			if(mf.IsClosure())
 			{
+				stack->Check(1);
 				stack->Push(mf);
 				Insert(-(nArgs + 2));
 				nArgs += 1;
@@ -868,122 +1442,66 @@ void LuaState::Call(int nArgs, int nResults)
 		}
 	}
 
-	if(val.IsClosure())
-	{
-		ClosurePtr c = val.closure;
-		if(c->proto)
-		{
-			DEBUG_PRINT("call %s<%d,%d>", c->proto->Source.c_str(),
-				c->proto->LineDefined,
-				c->proto->LastLineDefined);
-		}
-		else
-		{
-			auto it = cFuncNames.find(c->cFunc);
-			if (it != cFuncNames.end() && it->second.length() > 0)
-			{
-				DEBUG_PRINT("%s", it->second.c_str());
-			}
-			else
-			{
-				DEBUG_PRINT("call c function");
-			}
-		}
-
-		if(c->proto != nullptr)
-			CallLuaClosure(nArgs, nResults, c);
-		else
-			CallCClosure(nArgs, nResults, c);
-	}
-	else
+	if(!val.IsClosure())
 	{
 		panic("not a function");
+		return nullptr;
 	}
-}
 
-void LuaState::TailCall(int idx, int nArgs)
-{
-	LuaValue val = stack->Get(idx);
-	LuaValueArray args;
-	LuaValueArray results;
-	if (!val.IsClosure())
+	ClosurePtr c = val.AsClosure();
+	if(c->proto)
 	{
-		LuaValue mf = ::GetMetafield(val, "__call", this);
-		if (mf != LuaValue::Nil)
-		{
-			if (mf.IsClosure())
-			{
-				args.push_back(std::move(val));
-				val = mf;
-			}
-		}
+		DEBUG_PRINT("call %s<%d,%d>", c->proto->Source.c_str(),
+			c->proto->LineDefined,
+			c->proto->LastLineDefined);
 	}
-
-	if (val.IsClosure())
+	else
 	{
-		int prevTop = GetTop();
-		int prevPc = stack->pc;
-		ClosurePtr prevClosure = stack->closure;
-		std::unordered_map<int, UpValue> prevOpenuvs = std::move(stack->openuvs);
-		LuaValueArray prevVarags = std::move(stack->varargs);
-
-		for (int i = idx + 1; i < idx + 1 + nArgs; ++i)
+		auto it = cFuncNames.find(c->cFunc);
+		if (it != cFuncNames.end() && it->second.length() > 0)
 		{
-			args.push_back(stack->Get(i));
-		}
-
-		ClosurePtr c = val.closure;
-
-		stack->top = 0;
-
-		if (c->proto)
-		{
-			int nRegs = c->proto->MaxStackSize;
-			CheckStack(nRegs);
-
-			for (int i = 0; i < c->proto->NumParams; ++i)
-				stack->Push(args[i]);
-
-			for (int i = c->proto->NumParams; i < (int)args.size(); ++i)
-				stack->varargs.push_back(args[i]);
-
-			SetTop(nRegs);
-			stack->pc = 0;
-			stack->closure = c;
-			RunLuaClosure();
-
-			results = stack->PopN(stack->top - nRegs);
+			DEBUG_PRINT("%s", it->second.c_str());
 		}
 		else
 		{
-			int nRegs = c->proto->NumParams + LUA_MINSTACK;
-			CheckStack(nRegs);
-
-			for (int i = 0; i < c->proto->NumParams; ++i)
-				stack->Push(args[i]);
-
-			for (int i = c->proto->NumParams; i < (int)args.size(); ++i)
-				stack->varargs.push_back(args[i]);
-
-			SetTop(nRegs);
-			stack->pc = 0;
-			stack->closure = c;
-			int r = c->cFunc(this);
-			results = stack->PopN(r);
+			DEBUG_PRINT("call c function");
 		}
-
-		SetTop(prevTop);
-		stack->pc = prevPc;
-		stack->closure = prevClosure;
-		stack->openuvs = std::move(prevOpenuvs);
-		stack->varargs = std::move(prevVarags);
-
-		stack->PushN(results, (int)results.size());
 	}
+	return c;
+}
+
+void LuaState::Call(int nArgs, int nResults)
+{
+	ClosurePtr c = _CallTarget(nArgs);
+	if(c->proto != nullptr)
+		CallLuaClosure(nArgs, nResults, c);
 	else
+		CallCClosure(nArgs, nResults, c);
+}
+
+// The function and its arguments are on the top of the stack
+bool LuaState::TailCall(int nArgs)
+{
+	ClosurePtr c = _CallTarget(nArgs);
+	if(c->proto == nullptr)
 	{
-		panic("not a function");
+		CallCClosure(nArgs, -1, c);
+		return false;
 	}
+
+	CallInfo* ci = stack->ci;
+	stack->CloseUpvalues(ci->base);
+	int oldTop = stack->top;
+	int from = oldTop - nArgs - 1;
+	// Move the function and the arguments down over the running frame
+	for(int i = 0; i <= nArgs; ++i)
+		stack->slots[ci->func + i] = stack->slots[from + i];
+
+	ci->closure = c;
+	ci->pc = 0;
+	ci->varargs.clear();
+	_InitLuaFrame(ci, nArgs, oldTop);
+	return true;
 }
 
 void LuaState::PushCClosure(CFunction c, int n)
@@ -991,8 +1509,7 @@ void LuaState::PushCClosure(CFunction c, int n)
 	ClosurePtr closure = NewCClosure(c, n);
 	for(int i = n; i > 0; --i)
 	{
-		LuaValuePtr val = stack->Pop();
-		closure->upvals[i - 1] = UpValue(val);
+		closure->upvals[i - 1] = NewClosedUpValue(stack->Pop());
 	}
 	stack->Push(LuaValue(closure));
 }
@@ -1007,7 +1524,7 @@ bool LuaState::IsCFunction(int idx)
 	LuaValue val = stack->Get(idx);
 	if(val.IsClosure())
 	{
-		return val.closure->cFunc != nullptr;
+		return val.AsClosure()->cFunc != nullptr;
 	}
 	return false;
 }
@@ -1017,7 +1534,7 @@ CFunction LuaState::ToCFunction(int idx)
 	LuaValue val = stack->Get(idx);
 	if(val.IsClosure())
 	{
-		return val.closure->cFunc;
+		return val.AsClosure()->cFunc;
 	}
 	return nullptr;
 }
@@ -1027,7 +1544,7 @@ bool LuaState::IsProto(int idx)
 	LuaValue val = stack->Get(idx);
 	if (val.IsClosure())
 	{
-		return val.closure->proto != nullptr;
+		return val.AsClosure()->proto != nullptr;
 	}
 	return false;
 }
@@ -1037,27 +1554,27 @@ PrototypePtr LuaState::ToProto(int idx)
 	LuaValue val = stack->Get(idx);
 	if (val.IsClosure())
 	{
-		return val.closure->proto;
+		return val.AsClosure()->proto;
 	}
 	return nullptr;
 }
 
 void LuaState::PushGlobalTable()
 {
-	LuaValue global = *registry->Get(LuaValue(LUA_RIDX_GLOBALS));
+	LuaValue global = registry->GetInt(LUA_RIDX_GLOBALS);
 	stack->Push(global);
 }
 
 LuaType LuaState::GetGlobal(const String& name)
 {
-	LuaValue t = *registry->Get(LuaValue(LUA_RIDX_GLOBALS));
+	LuaValue t = registry->GetInt(LUA_RIDX_GLOBALS);
 	return _GetTable(t, LuaValue(name), true);
 }
 
 void LuaState::SetGlobal(const String& name)
 {
-	LuaValue t = *registry->Get(LuaValue(LUA_RIDX_GLOBALS));
-	LuaValue v = *stack->Pop();
+	LuaValue t = registry->GetInt(LUA_RIDX_GLOBALS);
+	LuaValue v = stack->Pop();
 	_SetTable(t, LuaValue(name), v, true);
 }
 
@@ -1085,14 +1602,14 @@ bool LuaState::GetMetatable(int idx)
 void LuaState::SetMetatable(int idx)
 {
 	LuaValue val = stack->Get(idx);
-	LuaValue mtVal = *stack->Pop();
+	LuaValue mtVal = stack->Pop();
 	if(mtVal == LuaValue::Nil)
 	{
-		::SetMetatable(val, LuaTable::NilPtr, this);
+		::SetMetatable(val, nullptr, this);
 	}
 	else if(mtVal.IsTable())
 	{
-		::SetMetatable(val, mtVal.table, this);
+		::SetMetatable(val, mtVal.AsTable(), this);
 	}
 	else
 	{
@@ -1105,13 +1622,12 @@ bool LuaState::Next(int idx)
 	LuaValue val = stack->Get(idx);
 	if(val.IsTable())
 	{
-		LuaValue key = *stack->Pop();
-		LuaTablePtr tbl = val.table;
-		LuaValue nextKey = tbl->NextKey(key);
-		if(nextKey != LuaValue::Nil)
+		LuaValue key = stack->Pop();
+		LuaValue nextKey, nextVal;
+		if(val.AsTable()->Next(key, nextKey, nextVal))
 		{
 			stack->Push(nextKey);
-			stack->Push(*tbl->Get(nextKey));
+			stack->Push(nextVal);
 			return true;
 		}
 		return false;
@@ -1122,11 +1638,50 @@ bool LuaState::Next(int idx)
 
 int LuaState::Error()
 {
-	LuaValue err = *stack->Pop();
-	panic(err.str.c_str());
+	LuaValue err = stack->Pop();
+	panic(err.AsString().c_str());
 	return LUA_ERRRUN;
 }
 
+int LuaState::GC(int what, int data)
+{
+	switch(what)
+	{
+		case LUA_GCSTOP: g_gc.running = false; return 0;
+		case LUA_GCRESTART: g_gc.running = true; return 0;
+		case LUA_GCCOLLECT: g_gc.FullGC(); return 0;
+		case LUA_GCCOUNT: return (int)(g_gc.totalbytes >> 10);
+		case LUA_GCCOUNTB: return (int)(g_gc.totalbytes & 0x3ff);
+		case LUA_GCSTEP:
+		{
+			// data is the amount of work in KB, 0 means a single basic step
+			int steps = 1 + (int)((size_t)std::max(data, 0) * 1024 / GC_STEPSIZE);
+			for(int i = 0; i < steps; ++i)
+			{
+				if(g_gc.Step())
+					return 1;
+			}
+			return 0;
+		}
+		case LUA_GCSETPAUSE:
+		{
+			int prev = g_gc.pause;
+			g_gc.pause = data;
+			return prev;
+		}
+		case LUA_GCSETSTEPMUL:
+		{
+			int prev = g_gc.stepmul;
+			g_gc.stepmul = data;
+			return prev;
+		}
+		case LUA_GCISRUNNING: return g_gc.running ? 1 : 0;
+		case LUA_GCGEN: return g_gc.SetMode(GC_GENERATIONAL) == GC_GENERATIONAL ? LUA_GCGEN : LUA_GCINC;
+		case LUA_GCINC: return g_gc.SetMode(GC_INCREMENTAL) == GC_GENERATIONAL ? LUA_GCGEN : LUA_GCINC;
+		default: return -1;
+	}
+}
+
 void LuaState::_Call(int nArgs, int nResults)
 {
 	Call(nArgs, nResults);
@@ -1142,31 +1697,20 @@ int LuaState::PCall(int nArgs, int nResults, int msgh)
 /*
 interfaces for luavm
 */
-int LuaState::PC() const { return stack->pc; }
+int LuaState::PC() const { return stack->ci->pc; }
 
-void LuaState::AddPC(int n) { stack->pc += n; }
+void LuaState::AddPC(int n) { stack->ci->pc += n; }
 
+// The code has been verified when it was loaded
 UInt32 LuaState::Fetch()
 {
-	panic_cond(stack, "stack must not empty");
-	panic_cond(stack->closure, "closure must not empty");
-	panic_cond(stack->closure->proto, "proto must not empty");
-	panic_cond(stack->pc < (int)stack->closure->proto->Code.size(), "pc out of bound");
-	return stack->closure->proto->Code[stack->pc++];
+	CallInfo* ci = stack->ci;
+	return ci->closure->proto->Code[ci->pc++];
 }
 
 void LuaState::GetConst(int idx)
 {
-	Constant c = stack->closure->proto->Constants[idx];
-	switch (c.tag)
-	{
-		case TAG_NIL: stack->Push(LuaValue::Nil); break;
-		case TAG_BOOLEAN: stack->Push(LuaValue(c.boolean)); break;
-		case TAG_NUMBER: stack->Push(LuaValue(c.luaNum)); break;
-		case TAG_INTEGER: stack->Push(LuaValue(c.luaInteger)); break;
-		case TAG_SHORT_STR:
-		case TAG_LONG_STR: stack->Push(LuaValue(c.str)); break;
-	}
+	stack->Push(stack->ci->closure->proto->K[idx]);
 }
 
 void LuaState::GetRK(int rk)
@@ -1177,21 +1721,29 @@ void LuaState::GetRK(int rk)
 		PushValue(rk + 1);
 }
 
-int LuaState::RegisterCount() const { return stack->closure->proto->MaxStackSize;	}
+int LuaState::RegisterCount() const { return stack->ci->closure->proto->MaxStackSize; }
 
 void LuaState::LoadVararg(int n)
 {
+	const LuaValueArray& varargs = stack->ci->varargs;
 	if(n < 0)
-		n = (int)stack->varargs.size();
+		n = (int)varargs.size();
 	stack->Check(n);
-	stack->PushN(stack->varargs, n);
+	stack->PushN(varargs, n);
 }
 
 void LuaState::LoadProto(int idx)
 {
-	PrototypePtr subProto = stack->closure->proto->Protos[idx];
-	ClosurePtr closure = NewLuaClosure(subProto);
+	ClosurePtr closure = _NewClosure(idx);
 	stack->Push(LuaValue(closure));
+}
+
+// Instantiate sub prototype idx of the running function, capturing its upvalues
+ClosurePtr LuaState::_NewClosure(int idx)
+{
+	CallInfo* ci = stack->ci;
+	PrototypePtr subProto = ci->closure->proto->Protos[idx];
+	ClosurePtr closure = NewLuaClosure(subProto);
 
 	for(size_t i = 0; i < subProto->Upvalues.size(); ++i)
 	{
@@ -1200,96 +1752,57 @@ void LuaState::LoadProto(int idx)
 
 		if(uvInfo.Instack == 1)
 		{
-			auto it = stack->openuvs.find(uvIdx);
-			if(it == stack->openuvs.end())
-			{
-				closure->upvals[i] = UpValue(stack->slots[uvIdx]);
-				stack->openuvs[uvIdx] = closure->upvals[i];
-			}
-			else
-			{
-				closure->upvals[i] = it->second;
-			}
+			closure->upvals[i] = stack->FindUpvalue(ci->base + uvIdx);
 		}
 		else
 		{
-			closure->upvals[i] = stack->closure->upvals[uvIdx];
+			closure->upvals[i] = ci->closure->upvals[uvIdx];
 		}
 	}
+	return closure;
 }
 
 void LuaState::CloseUpvalues(int a)
 {
-	for(auto it = stack->openuvs.begin(); it != stack->openuvs.end();)
-	{
-		int i = it->first;
-		if(i >= a - 1)
-		{
-			it = stack->openuvs.erase(it);
-		}
-		else
-		{
-			++it;
-		}
-	}
+	stack->CloseUpvalues(stack->ci->base + a - 1);
 }
 
 /* Coroutine */
 
 LuaStatePtr LuaState::NewThread()
 {
-	LuaStatePtr t = LuaStatePtr(new LuaState());
+	LuaStatePtr t = g_gc.New<LuaState>();
 	t->registry = registry;
-	t->PushLuaStack(NewLuaStack(LUA_MINSTACK, t.get()));
+	t->stack = NewLuaStack(LUA_MINSTACK, t.get());
 	stack->Push(LuaValue(t));
 	return t;
 }
 
 bool LuaState::IsMainThread()
 {
-	LuaValue mainThread = *registry->Get(LuaValue(LUA_RIDX_MAINTHREAD));
-	return mainThread.state.get() == this;
+	LuaValue mainThread = registry->GetInt(LUA_RIDX_MAINTHREAD);
+	return mainThread.AsThread() == this;
 }
 
-void LuaState::_FixYieldStack(int nArgs)
+// Complete the call instruction of the running frame after the callee returned,
+// its results are already in place from the function slot
+void LuaState::_FinishCall()
 {
-	// Resume values have been pushed into the current stack
-	LuaValueArray arguments = stack->PopN(nArgs);
-	// Pop the yield call stack
-	PopLuaStack();
-	// Check the stack size
-	stack->Check(nArgs);
-	// Push the resume arguments into the stack as yield returns
-	stack->PushN(arguments, nArgs);
-	// Recover the pc
-	--stack->pc;
-
-	Instruction inst = Instruction(Fetch());
+	CallInfo* ci = stack->ci;
+	const PrototypePtr& proto = ci->closure->proto;
+	Instruction inst = Instruction(proto->Code[ci->pc - 1]);
 	int opCode = inst.Opcode();
-	panic_cond(opCode == OP_CALL || opCode == OP_TAILCALL, "must fix a function call");
 
-	// Finish the unfinished process
-	if (opCode == OP_CALL)
-	{
-		auto abc = inst.ABC();
-		int a = std::get<0>(abc) + 1;
-		// int b = std::get<1>(abc);
-		int c = std::get<2>(abc);
-		__call_insts__::_popResults(a, c, this);
-	}
-	else if (opCode == OP_TAILCALL)
-	{
-		auto ab_ = inst.ABC();
-		int a = std::get<0>(ab_) + 1;
-		// int b = std::get<1>(ab_);
-		int c = 0;
-		__call_insts__::_popResults(a, c, this);
-	}
+	if((opCode == OP_CALL && inst.C() != 0) || opCode == OP_TFORCALL)
+		stack->top = ci->base + (int)proto->MaxStackSize;
+	else if(opCode != OP_CALL && opCode != OP_TAILCALL)
+		panic("must fix a function call");
 }
 
 int LuaState::_ProtectedRun(FunctionCall func, int nArgs, int nResults)
 {
-	LuaStackPtr caller = stack;
+	CallInfo* caller = stack->ci;
+	int oldTop = stack->top - nArgs - 1;
 	try
 	{
 		(this->*func)(nArgs, nResults);
@@ -1298,10 +1811,18 @@ int LuaState::_ProtectedRun(FunctionCall func, int nArgs, int nResults)
 	{
 		if (st == LUA_ERRRUN || st == LUA_ERRERR)
 		{
-			while (stack != caller)
+			// A resumed coroutine has already left the frame it yielded from
+			while (stack->ci != caller && stack->ci != &stack->baseCi)
+			{
+				stack->PopFrame();
+			}
+			oldTop = std::max(std::min(oldTop, stack->top), stack->ci->base);
+			for (int i = oldTop; i < stack->top; ++i)
 			{
-				PopLuaStack();
+				stack->slots[i] = LuaValue::Nil;
 			}
+			stack->top = oldTop;
+			stack->Check(1);
 			stack->Push(LuaValue(g_panic_message));
 		}
 		return st;
@@ -1325,47 +1846,23 @@ void LuaState::_Resume(int nArgs, int nResults)
 	else
 	{
 		coStatus = LUA_OK;
-		_FixYieldStack(nArgs);
-
-		LuaStackPtr newStack = stack;
-
-		if (stack->closure->proto)
-		{
-			int nRegs = (int)stack->closure->proto->MaxStackSize;
-
-			RunLuaClosure();
-			PopLuaStack();
-
-			panic_cond(!stack->closure || stack->closure->cFunc || stack->top == stack->closure->proto->MaxStackSize,
-				"return values must locate on MaxStackSize of current call frame");
+		// Resume values have been pushed into the frame of the yield call, they are its results
+		_PostCall(stack->top - nArgs);
 
-			if (nResults != 0)
-			{
-				// Pop the return values from the newStack
-				LuaValueArray results = newStack->PopN(newStack->top - nRegs);
-				stack->Check((int)results.size());
-				// nResults not "(int)results.size()" for some ticky usage
-				stack->PushN(results, nResults);
-			}
-		}
-		else
+		// Run every frame the yield interrupted down to the first one
+		while (stack->ci != &stack->baseCi)
 		{
-			int r = stack->closure->cFunc(this);
-			PopLuaStack();
-
-			if (nResults != 0)
-			{
-				LuaValueArray results = stack->PopN(r);
-				newStack->Check((int)results.size());
-				stack->PushN(results, nResults);
-			}
+			CallInfo* ci = stack->ci;
+			panic_cond(ci->closure->proto, "attempt to yield across a C-call boundary");
+			_FinishCall();
+			int firstResult = RunLuaClosure();
+			_PostCall(firstResult);
 		}
 	}
 }
 
 int LuaState::Resume(LuaState* fromState, int nArgs)
 {
-	LuaStackPtr caller = stack;
 	// TODO
 	coStatus = _ProtectedRun(&LuaState::_Resume, nArgs, -1);
 	return coStatus;
@@ -1394,8 +1891,8 @@ bool LuaState::IsYieldable()
 LuaStatePtr LuaState::ToThread(int idx)
 {
 	LuaValue val = stack->Get(idx);
-	// val and val.state could be null or not
-	return val.state;
+	// val and its thread could be null or not
+	return val.AsThread();
 }
 
 void LuaState::XMove(LuaState* to, int n)
@@ -1406,7 +1903,7 @@ void LuaState::XMove(LuaState* to, int n)
 
 bool LuaState::GetStack()
 {
-	return stack->prev != nullptr;
+	return stack->ci != &stack->baseCi;
 }
 
 bool LuaState::PushThread()
@@ -0,0 +1,132 @@
+#include "state/lua_string.h"
+
+StringTable g_strt;
+
+StringTable::StringTable()
+{
+	count = 0;
+	buckets.resize(128, nullptr);
+}
+
+LuaString* StringTable::Find(const String& s, size_t hash) const
+{
+	for(LuaString* ls = buckets[hash & (buckets.size() - 1)]; ls; ls = ls->hnext)
+	{
+		if(ls->hash == hash && ls->str == s)
+			return ls;
+	}
+	return nullptr;
+}
+
+void StringTable::Insert(LuaString* s)
+{
+	if(count >= buckets.size())
+		_Resize(buckets.size() * 2);
+	LuaString*& head = buckets[s->hash & (buckets.size() - 1)];
+	s->hnext = head;
+	head = s;
+	++count;
+}
+
+void StringTable::Remove(LuaString* s)
+{
+	LuaString** p = &buckets[s->hash & (buckets.size() - 1)];
+	while(*p)
+	{
+		if(*p == s)
+		{
+			*p = s->hnext;
+			--count;
+			return;
+		}
+		p = &(*p)->hnext;
+	}
+}
+
+void StringTable::_Resize(size_t n)
+{
+	std::vector<LuaString*> old;
+	old.swap(buckets);
+	buckets.resize(n, nullptr);
+	for(LuaString* head : old)
+	{
+		while(head)
+		{
+			LuaString* next = head->hnext;
+			LuaString*& bucket = buckets[head->hash & (n - 1)];
+			head->hnext = bucket;
+			bucket = head;
+			head = next;
+		}
+	}
+}
+
+LuaString::~LuaString()
+{
+	if(isShort)
+		g_strt.Remove(this);
+}
+
+LuaString* NewLuaString(const String& s)
+{
+	size_t hash = LuaString::_BKDR(s.c_str(), s.length());
+	if(s.length() > LUAI_MAXSHORTLEN)
+		return g_gc.New<LuaString>(s, hash);
+
+	LuaString* ls = g_strt.Find(s, hash);
+	if(ls)
+	{
+		// dead but not swept yet, keep it for this cycle
+		if(g_gc.state == GCS_SWEEP)
+			ls->marked |= GC_BLACK;
+		return ls;
+	}
+	ls = g_gc.New<LuaString>(s, hash);
+	g_strt.Insert(ls);
+	return ls;
+}
+
+LuaString* NewLuaString(String&& s)
+{
+	if(s.length() <= LUAI_MAXSHORTLEN)
+		return NewLuaString((const String&)s);
+	size_t hash = LuaString::_BKDR(s.c_str(), s.length());
+	return g_gc.New<LuaString>(std::move(s), hash);
+}
+
+// Interned but never linked into the collector, so they are never freed
+static LuaString* _FixString(const char* name)
+{
+	String s = name;
+	LuaString* ls = new LuaString(s, LuaString::_BKDR(s.c_str(), s.length()));
+	g_strt.Insert(ls);
+	return ls;
+}
+
+LuaString* const g_tmnames[TM_N] =
+{
+	_FixString("__index"),
+	_FixString("__newindex"),
+	_FixString("__gc"),
+	_FixString("__mode"),
+	_FixString("__len"),
+	_FixString("__eq"),
+	_FixString("__add"),
+	_FixString("__sub"),
+	_FixString("__mul"),
+	_FixString("__mod"),
+	_FixString("__pow"),
+	_FixString("__div"),
+	_FixString("__idiv"),
+	_FixString("__band"),
+	_FixString("__bor"),
+	_FixString("__bxor"),
+	_FixString("__shl"),
+	_FixString("__shr"),
+	_FixString("__unm"),
+	_FixString("__bnot"),
+	_FixString("__lt"),
+	_FixString("__le"),
+	_FixString("__concat"),
+	_FixString("__call"),
+};
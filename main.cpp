@@ -4,6 +4,7 @@
 #include <cstring>
 #include "binchunk/binary_chunk.h"
 #include "binchunk/reader.h"
+#include "binchunk/mapped_file.h"
 #include "state/lua_state.h"
 #include "number/parser.h"
 #include "state/api_arith.h"
@@ -32,13 +33,13 @@ String KindToCategory(int kind)
 
 void testLexer(const String& chunk, const String& chunkName)
 {
-	LexerPtr lexer = NewLexer(chunk, chunkName);
+	LexerPtr lexer = NewLexer(chunk.data(), chunk.size(), chunkName);
 	while(true)
 	{
 		TokenResult res = lexer->NextToken();
 		String msg = Format::FormatString("[%2d] [%-10s] %s", res.line,
 			KindToCategory(res.kind).c_str(),
-			res.token.c_str());
+			res.token.Str().c_str());
 		printf("%s\n", msg.c_str());
 		if(res.kind == TOKEN_EOF)
 			break;
@@ -47,7 +48,8 @@ void testLexer(const String& chunk, const String& chunkName)
 
 void testParser(const String& chunk, const String& chunkName)
 {
-	BlockPtr ast = Parse(chunk, chunkName);
+	AstArena arena;
+	BlockPtr ast = Parse(chunk.data(), chunk.size(), chunkName);
 	FILE* fp = fopen("parser_tree.txt", "wb");
 	DumpBlock(ast, 0, fp);
 	fclose(fp);
@@ -90,22 +92,12 @@ int main()
 	}
 #else
 	//FILE* f = fopen("C:/LearnCompiler/lua-5.3.6/src/hello.luac", "rb");
-	FILE* f = fopen("mymod.lua", "rb");
-	if (f)
+	MappedFile file;
+	if (file.Open("mymod.lua"))
 	{
-		fseek(f, 0, SEEK_END);
-		long size = ftell(f);
-		fseek(f, 0, SEEK_SET);
-
-		std::vector<Byte> buffer;
-		buffer.resize(size);
-		fread(buffer.data(), 1, size, f);
-		fclose(f);
-		f = NULL;
-
 		LuaStatePtr state = NewLuaState();
 		state->OpenLibs();
-		state->Load(buffer, "chunk", "b");
+		state->Load(file.Data(), file.Size(), "chunk", "b");
 		state->Call(0, 0);
 	}
 #endif
@@ -28,8 +28,11 @@ inline Float64 FMod(Float64 a, Float64 b)
 inline Int64 ShiftLeft(Int64 a, Int64 n)
 {
 	extern Int64 ShiftRight(Int64, Int64);
+	// shifting by 64 bits or more either way leaves nothing
+	if(n >= 64 || n <= -64)
+		return 0;
 	if(n >= 0)
-		return a << n;
+		return (Int64)((UInt64)a << n);
 	else
 		return ShiftRight(a, -n);
 }
@@ -37,6 +40,8 @@ inline Int64 ShiftLeft(Int64 a, Int64 n)
 inline Int64 ShiftRight(Int64 a, Int64 n)
 {
 	extern Int64 ShiftLeft(Int64, Int64);
+	if(n >= 64 || n <= -64)
+		return 0;
 	if(n >= 0)
 		return (Int64)((UInt64)a >> n);
 	else
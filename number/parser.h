@@ -64,6 +64,7 @@ inline std::tuple<Float64, bool> ParseFloat(const String& str)
 	bool success = true;
 	bool meetDot = false;
 	bool meetE = false;
+	Float64 expSign = 1;
 
 	if(str.length() && str[0] == '-')
 		sign = -1;
@@ -104,7 +105,7 @@ inline std::tuple<Float64, bool> ParseFloat(const String& str)
 						break;
 					}
 					Float64 e = (Float64)std::get<0>(pair);
-					number = number * pow(2.0, e);
+					number = number * pow(2.0, e * expSign);
 					// fast break
 					i = str.size() - 1;
 				}
@@ -131,6 +132,13 @@ inline std::tuple<Float64, bool> ParseFloat(const String& str)
 				}
 				meetE = true;
 				meetDot = false;
+				// the exponent may be signed
+				if(i + 1 < str.size() && (str[i + 1] == '-' || str[i + 1] == '+'))
+				{
+					if(str[i + 1] == '-')
+						expSign = -1;
+					++i;
+				}
 			}
 			else if(c == 'f' && i != str.size() - 1)
 			{
@@ -162,7 +170,7 @@ inline std::tuple<Float64, bool> ParseFloat(const String& str)
 						break;
 					}
 					Float64 e = (Float64)std::get<0>(pair);
-					number = number * pow(10.0, e);
+					number = number * pow(10.0, e * expSign);
 					// fast break
 					i = str.size() - 1;
 				}
@@ -189,6 +197,13 @@ inline std::tuple<Float64, bool> ParseFloat(const String& str)
 				}
 				meetE = true;
 				meetDot = false;
+				// the exponent may be signed
+				if(i + 1 < str.size() && (str[i + 1] == '-' || str[i + 1] == '+'))
+				{
+					if(str[i + 1] == '-')
+						expSign = -1;
+					++i;
+				}
 			}
 			else if(c == 'f' && i != str.size() - 1)
 			{
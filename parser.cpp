@@ -32,21 +32,25 @@ StatPtr ParseBreakStat(LexerPtr lexer)
 StatPtr ParseLabelStat(LexerPtr lexer)
 {
 	lexer->NextTokenKind(TOKEN_SEP_LABEL);
-	String name = lexer->NextIdentifier().token;
+	int line = lexer->Line();
+	String name = lexer->NextIdentifier().token.Str();
 	lexer->NextTokenKind(TOKEN_SEP_LABEL);
 
 	StatPtr label = Stat::New<LabelStat>();
 	label->Cast<LabelStat>()->Name = name;
+	label->Cast<LabelStat>()->Line = line;
 	return label;
 }
 
 StatPtr ParseGotoStat(LexerPtr lexer)
 {
 	lexer->NextTokenKind(TOKEN_KW_GOTO);
-	String name = lexer->NextIdentifier().token;
+	int line = lexer->Line();
+	String name = lexer->NextIdentifier().token.Str();
 
 	StatPtr _goto = Stat::New<GotoStat>();
 	_goto->Cast<GotoStat>()->Name = name;
+	_goto->Cast<GotoStat>()->Line = line;
 	return _goto;
 }
 
@@ -166,7 +170,7 @@ StringArray _FinishNameList(LexerPtr lexer, const String& name0)
 	while(lexer->LookAhead() == TOKEN_SEP_COMMA)
 	{
 		lexer->NextToken();
-		names.emplace_back(lexer->NextIdentifier().token);
+		names.emplace_back(lexer->NextIdentifier().token.Str());
 	}
 	return names;
 }
@@ -191,7 +195,7 @@ StatPtr _FinishForInStat(LexerPtr lexer, const String& name0)
 StatPtr ParseForStat(LexerPtr lexer)
 {
 	int lineOfFor = lexer->NextTokenKind(TOKEN_KW_FOR).line;
-	String name = lexer->NextIdentifier().token;
+	String name = lexer->NextIdentifier().token.Str();
 	if(lexer->LookAhead() == TOKEN_OP_ASSIGN)
 	{
 		return _FinishForNumStat(lexer, lineOfFor, name);
@@ -205,7 +209,7 @@ StatPtr ParseForStat(LexerPtr lexer)
 StatPtr _FinishLocalFuncDefStat(LexerPtr lexer)
 {
 	lexer->NextTokenKind(TOKEN_KW_FUNCTION);
-	String name = lexer->NextIdentifier().token;
+	String name = lexer->NextIdentifier().token.Str();
 	// function body
 	ExpPtr fdExp = ParseFuncDefExp(lexer);
 
@@ -217,7 +221,7 @@ StatPtr _FinishLocalFuncDefStat(LexerPtr lexer)
 
 StatPtr _FinishLocalVarDeclStat(LexerPtr lexer)
 {
-	String name0 = lexer->NextIdentifier().token;
+	String name0 = lexer->NextIdentifier().token.Str();
 	StringArray nameList = _FinishNameList(lexer, name0);
 	ExpArray expList;
 	if(lexer->LookAhead() == TOKEN_OP_ASSIGN)
@@ -239,7 +243,7 @@ std::tuple<ExpPtr, bool> _ParseFuncName(LexerPtr lexer)
 	TokenKindResult res = lexer->NextIdentifier();
 	ExpPtr exp = Exp::New<NameExp>();
 	exp->Cast<NameExp>()->Line = res.line;
-	exp->Cast<NameExp>()->Name = res.token;
+	exp->Cast<NameExp>()->Name = res.token.Str();
 
 	bool hasColon = false;
 	while(lexer->LookAhead() == TOKEN_SEP_DOT)
@@ -249,7 +253,7 @@ std::tuple<ExpPtr, bool> _ParseFuncName(LexerPtr lexer)
 
 		ExpPtr idx = Exp::New<StringExp>();	
 		idx->Cast<StringExp>()->Line = res.line;
-		idx->Cast<StringExp>()->Val = res.token;
+		idx->Cast<StringExp>()->Val = res.token.Str();
 
 		ExpPtr newExp = Exp::New<TableAccessExp>();
 		newExp->Cast<TableAccessExp>()->LastLine = res.line;
@@ -264,7 +268,7 @@ std::tuple<ExpPtr, bool> _ParseFuncName(LexerPtr lexer)
 
 		ExpPtr idx = Exp::New<StringExp>();	
 		idx->Cast<StringExp>()->Line = res.line;
-		idx->Cast<StringExp>()->Val = res.token;
+		idx->Cast<StringExp>()->Val = res.token.Str();
 
 		ExpPtr newExp = Exp::New<TableAccessExp>();
 		newExp->Cast<TableAccessExp>()->LastLine = res.line;
@@ -451,8 +455,9 @@ ExpArray ParseRetExps(LexerPtr lexer)
 
 BlockPtr ParseBlock(LexerPtr lexer)
 {
-	BlockPtr block = BlockPtr(new Block());
+	BlockPtr block = AstArena::Current()->New<Block>();
 	block->Stats = ParseStats(lexer);
+	block->HasReturn = lexer->LookAhead() == TOKEN_KW_RETURN;
 	block->RetExps = ParseRetExps(lexer);
 	block->LastLine = lexer->Line();
 	return block;
@@ -463,7 +468,7 @@ ExpPtr ParseNumberExp(LexerPtr lexer)
 {	
 	TokenResult res = lexer->NextToken();
 
-	auto intPair = ParseInteger(res.token);
+	auto intPair = ParseInteger(res.token.Str());
 	if(std::get<1>(intPair))
 	{
 		ExpPtr exp;
@@ -473,7 +478,7 @@ ExpPtr ParseNumberExp(LexerPtr lexer)
 		return exp;
 	}
 
-	auto floatPair = ParseFloat(res.token);
+	auto floatPair = ParseFloat(res.token.Str());
 	if(std::get<1>(floatPair))
 	{
 		ExpPtr exp;
@@ -483,7 +488,7 @@ ExpPtr ParseNumberExp(LexerPtr lexer)
 		return exp;
 	}
 
-	Error("not a number: %s", res.token.c_str());
+	Error("not a number: %s", res.token.Str().c_str());
 	return nullptr;
 }
 
@@ -591,13 +596,13 @@ std::tuple<StringArray, bool> _ParseParList(LexerPtr lexer)
 
 	StringArray names;
 	bool isVararg = false;
-	names.emplace_back(lexer->NextToken().token);
+	names.emplace_back(lexer->NextToken().token.Str());
 	while(lexer->LookAhead() == TOKEN_SEP_COMMA)
 	{
 		lexer->NextToken();
 		if(lexer->LookAhead() == TOKEN_IDENTIFIER)
 		{
-			names.emplace_back(lexer->NextToken().token);
+			names.emplace_back(lexer->NextToken().token.Str());
 		}
 		else
 		{
@@ -671,7 +676,7 @@ ExpPtr ParseExp0(LexerPtr lexer)
 			TokenResult res = lexer->NextToken();
 			exp = Exp::New<StringExp>();
 			exp->Cast<StringExp>()->Line = res.line;
-			exp->Cast<StringExp>()->Val = res.token;
+			exp->Cast<StringExp>()->Val = res.token.Str();
 			break;
 		}
 		case TOKEN_NUMBER:
@@ -964,7 +969,7 @@ ExpPtr _ParseNameExp(LexerPtr lexer)
 		TokenKindResult res = lexer->NextIdentifier();
 		ExpPtr exp = Exp::New<StringExp>();
 		exp->Cast<StringExp>()->Line = res.line;
-		exp->Cast<StringExp>()->Val = res.token;
+		exp->Cast<StringExp>()->Val = res.token.Str();
 		return exp;
 	}
 	return nullptr;
@@ -995,7 +1000,7 @@ ExpArray _ParseArgs(LexerPtr lexer)
 			TokenKindResult res = lexer->NextTokenKind(TOKEN_STRING);
 			ExpPtr exp = Exp::New<StringExp>();
 			exp->Cast<StringExp>()->Line = res.line;
-			exp->Cast<StringExp>()->Val = res.token;
+			exp->Cast<StringExp>()->Val = res.token.Str();
 			args.emplace_back(exp);
 			break;
 		}
@@ -1045,7 +1050,7 @@ ExpPtr _FinishPrefixExp(LexerPtr lexer, ExpPtr exp)
 
 				ExpPtr keyExp = Exp::New<StringExp>();
 				keyExp->Cast<StringExp>()->Line = res.line;
-				keyExp->Cast<StringExp>()->Val = res.token;
+				keyExp->Cast<StringExp>()->Val = res.token.Str();
 
 				ExpPtr newExp = Exp::New<TableAccessExp>();
 				newExp->Cast<TableAccessExp>()->LastLine = res.line;
@@ -1078,7 +1083,7 @@ ExpPtr ParsePrefixExp(LexerPtr lexer)
 		TokenKindResult res = lexer->NextIdentifier();
 		exp = Exp::New<NameExp>();
 		exp->Cast<NameExp>()->Line = res.line;
-		exp->Cast<NameExp>()->Name = res.token;
+		exp->Cast<NameExp>()->Name = res.token.Str();
 	}
 	else
 	{
@@ -1212,6 +1217,7 @@ ExpPtr OptimizeArithBinaryOp(ExpPtr exp)
 					newExp->Cast<IntegerExp>()->Val = IFloorDiv(x->Val, y->Val);
 					return newExp;
 				}
+				break;
 			}
 			case TOKEN_OP_MOD:
 			{
@@ -1222,6 +1228,7 @@ ExpPtr OptimizeArithBinaryOp(ExpPtr exp)
 					newExp->Cast<IntegerExp>()->Val = IMod(x->Val, y->Val);
 					return newExp;
 				}
+				break;
 			}
 		}
 	}
@@ -1264,6 +1271,7 @@ ExpPtr OptimizeArithBinaryOp(ExpPtr exp)
 					newExp->Cast<FloatExp>()->Val = x / y;
 					return newExp;
 				}
+				break;
 			}
 			case TOKEN_OP_IDIV:
 			{
@@ -1274,6 +1282,7 @@ ExpPtr OptimizeArithBinaryOp(ExpPtr exp)
 					newExp->Cast<FloatExp>()->Val = FFloorDiv(x, y);
 					return newExp;
 				}
+				break;
 			}
 			case TOKEN_OP_MOD:
 			{
@@ -1284,6 +1293,7 @@ ExpPtr OptimizeArithBinaryOp(ExpPtr exp)
 					newExp->Cast<FloatExp>()->Val = FMod(x, y);
 					return newExp;
 				}
+				break;
 			}
 			case TOKEN_OP_POW:
 			{
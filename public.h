@@ -32,44 +32,79 @@ using StringArray = std::vector<String>;
 #endif
 #endif
 
+enum GCMark
+{
+	GC_GRAY = 1, // reached, waiting in the gray list
+	GC_BLACK = 2, // reached and traversed
+	GC_OLD = 4, // generational mode: survived a collection
+	GC_TOUCHED = 8, // generational mode: old object written since the last collection
+};
+
+struct LuaGC;
+
+// Base of every object a LuaValue can reference (string, table, closure, thread).
+// Objects are owned by the collector, see state/lua_gc.h
+struct LuaObject
+{
+	LuaObject* gcnext;
+	Byte marked;
+
+	LuaObject() : gcnext(nullptr), marked(0) {}
+	LuaObject(const LuaObject&) = delete;
+	LuaObject& operator=(const LuaObject&) = delete;
+	virtual ~LuaObject() {}
+
+	// Mark every object referenced by this one
+	virtual void Traverse(LuaGC* gc) {}
+	// Rough memory footprint used by the pacer
+	virtual size_t Size() const { return sizeof(LuaObject); }
+};
+
+// Handle to a collectable object. It does not own the object,
+// the collector frees it once it is no longer reachable
+template<typename T>
+struct ObjectPtr
+{
+	T* ptr;
+
+	ObjectPtr() : ptr(nullptr) {}
+	ObjectPtr(std::nullptr_t) : ptr(nullptr) {}
+	ObjectPtr(T* p) : ptr(p) {}
+
+	inline T* get() const { return ptr; }
+	inline T* operator->() const { return ptr; }
+	inline T& operator*() const { return *ptr; }
+	inline explicit operator bool() const { return ptr != nullptr; }
+	inline bool operator==(const ObjectPtr& rhs) const { return ptr == rhs.ptr; }
+	inline bool operator!=(const ObjectPtr& rhs) const { return ptr != rhs.ptr; }
+	inline bool operator==(std::nullptr_t) const { return ptr == nullptr; }
+	inline bool operator!=(std::nullptr_t) const { return ptr != nullptr; }
+};
+
 struct LuaTable;
-using LuaTablePtr = std::shared_ptr<LuaTable>;
+using LuaTablePtr = ObjectPtr<LuaTable>;
 
 struct Closure;
-using ClosurePtr = std::shared_ptr<Closure>;
+using ClosurePtr = ObjectPtr<Closure>;
+
+struct LuaString;
 
 struct LuaValue;
-using LuaValuePtr = std::shared_ptr<LuaValue>;
 
 struct LuaStack;
 using LuaStackPtr = std::shared_ptr<LuaStack>;
 
 struct LuaState;
-using LuaStatePtr = std::shared_ptr<LuaState>;
+using LuaStatePtr = ObjectPtr<LuaState>;
 
 struct Prototype;
-using PrototypePtr = std::shared_ptr<Prototype>;
+using PrototypePtr = std::shared_ptr<const Prototype>;
 
 struct UpValue;
 using UpValuePtr = std::shared_ptr<UpValue>;
 
 using LuaVM = LuaState;
 
-struct RTTI
-{
-	virtual ~RTTI() {}
-	template<typename T>
-	bool IsA()
-	{
-		return dynamic_cast<T*>(this) != nullptr;
-	}
-	template<typename T>
-	T* Cast()
-	{
-		return dynamic_cast<T*>(this);
-	}
-};
-
 extern String g_panic_message;
 
 inline void panic(const char* message)
@@ -8,7 +8,7 @@ inline bool _eq(const LuaValue& a, const LuaValue& b, LuaState* ls, bool raw)
 	{
 		case LUA_TNIL: return b.tag == LUA_TNIL;
 		case LUA_TBOOLEAN: return b.tag == LUA_TBOOLEAN && a.boolean == b.boolean;
-		case LUA_TSTRING: return b.tag == LUA_TSTRING && a.str == b.str;
+		case LUA_TSTRING: return b.tag == LUA_TSTRING && EqualString(a.AsLuaString(), b.AsLuaString());
 		case LUA_TNUMBER:
 		{
 			if(b.tag == LUA_TNUMBER)
@@ -34,7 +34,7 @@ inline bool _eq(const LuaValue& a, const LuaValue& b, LuaState* ls, bool raw)
 		{
 			if(!raw && b.tag == LUA_TTABLE && a != b && ls != nullptr)
 			{
-				auto metaRes = CallMetamethod(a, b, "__eq", ls);
+				auto metaRes = CallMetamethod(a, b, TM_EQ, ls);
 				if(std::get<1>(metaRes))
 				{
 					return ConvertToBoolean(std::get<0>(metaRes));
@@ -50,7 +50,7 @@ inline bool _lt(const LuaValue& a, const LuaValue& b, LuaState* ls, bool raw)
 {
 	switch (a.tag)
 	{
-		case LUA_TSTRING: if(b.tag == LUA_TSTRING) return a.str < b.str; break;
+		case LUA_TSTRING: if(b.tag == LUA_TSTRING) return a.AsString() < b.AsString(); break;
 		case LUA_TNUMBER:
 		{
 			if(b.tag == LUA_TNUMBER)
@@ -77,7 +77,7 @@ inline bool _lt(const LuaValue& a, const LuaValue& b, LuaState* ls, bool raw)
 
 	if(!raw)
 	{
-		auto metaRes = CallMetamethod(a, b, "__lt", ls);
+		auto metaRes = CallMetamethod(a, b, TM_LT, ls);
 		if(std::get<1>(metaRes))
 		{
 			return ConvertToBoolean(std::get<0>(metaRes));
@@ -92,7 +92,7 @@ inline bool _le(const LuaValue& a, const LuaValue& b, LuaState* ls, bool raw)
 {
 	switch (a.tag)
 	{
-		case LUA_TSTRING: if(b.tag == LUA_TSTRING) return a.str <= b.str; break;
+		case LUA_TSTRING: if(b.tag == LUA_TSTRING) return a.AsString() <= b.AsString(); break;
 		case LUA_TNUMBER:
 		{
 			if(b.tag == LUA_TNUMBER)
@@ -119,14 +119,14 @@ inline bool _le(const LuaValue& a, const LuaValue& b, LuaState* ls, bool raw)
 
 	if(!raw)
 	{
-		auto metaRes = CallMetamethod(a, b, "__le", ls);
+		auto metaRes = CallMetamethod(a, b, TM_LE, ls);
 		if(std::get<1>(metaRes))
 		{
 			return ConvertToBoolean(std::get<0>(metaRes));
 		}
 		else
 		{
-			metaRes = CallMetamethod(b, a, "__lt", ls);
+			metaRes = CallMetamethod(b, a, TM_LT, ls);
 			if(std::get<1>(metaRes))
 			{
 				return !ConvertToBoolean(std::get<0>(metaRes));
@@ -1,5 +1,6 @@
 #pragma once
 #include "binchunk/binary_chunk.h"
+#include "lua_value.h"
 
 typedef int(*CFunction)(LuaState* state);
 
@@ -21,26 +22,65 @@ struct FuncReg
 	}
 };
 
+// A variable captured by closures. While the function owning it runs the upvalue is open:
+// v points at its register in the thread stack. Closing copies the value in and v points at the copy.
 struct UpValue
 {
-	LuaValuePtr val;
+	LuaValue* v;
+	LuaValue value;
+	// while open: slot of the register and the next open upvalue down the stack
+	int level;
+	UpValuePtr next;
 
-	UpValue()
+	explicit UpValue(const LuaValue& val)
 	{
-		val = nullptr;
+		value = val;
+		v = &value;
+		level = -1;
 	}
 
-	explicit UpValue(LuaValuePtr _val)
+	UpValue(LuaValue* slot, int _level)
 	{
-		val = _val;
+		v = slot;
+		level = _level;
+	}
+
+	// v may point into the object itself
+	UpValue(const UpValue&) = delete;
+	UpValue& operator=(const UpValue&) = delete;
+
+	bool IsOpen() const { return v != &value; }
+
+	// While open the value lives in the stack, which the collector scans again
+	void Set(const LuaValue& val)
+	{
+		*v = val;
+		if(!IsOpen() && val.IsCollectable())
+			g_gc.BarrierForward(val.gc);
+	}
+
+	void Close()
+	{
+		value = *v;
+		v = &value;
+		level = -1;
+		next = nullptr;
+		if(value.IsCollectable())
+			g_gc.BarrierForward(value.gc);
 	}
 };
 
-struct Closure
+inline UpValuePtr NewClosedUpValue(const LuaValue& val) { return UpValuePtr(new UpValue(val)); }
+inline UpValuePtr NewOpenUpValue(LuaValue* slot, int level) { return UpValuePtr(new UpValue(slot, level)); }
+
+struct Closure : public LuaObject
 {
 	PrototypePtr proto;
 	CFunction cFunc;
-	std::vector<UpValue> upvals;
+	std::vector<UpValuePtr> upvals;
+
+	void Traverse(LuaGC* gc) override;
+	size_t Size() const override { return sizeof(Closure) + upvals.size() * sizeof(UpValuePtr); }
 
 	explicit Closure(PrototypePtr p)
 	{
@@ -55,16 +95,19 @@ struct Closure
 	}
 };
 
+inline LuaValue::LuaValue(const ClosurePtr& c) { _SetObject(LUA_TFUNCTION, c.get()); }
+inline Closure* LuaValue::AsClosure() const { return IsClosure() ? static_cast<Closure*>(gc) : nullptr; }
+
 inline ClosurePtr NewLuaClosure(PrototypePtr proto)
 {
-	ClosurePtr closure = ClosurePtr(new Closure(proto));
+	ClosurePtr closure = g_gc.New<Closure>(proto);
 	closure->upvals.resize(proto->Upvalues.size());
 	return closure;
 }
 
 inline ClosurePtr NewCClosure(CFunction c, int nUpVals)
 {
-	ClosurePtr closure = ClosurePtr(new Closure(c));
+	ClosurePtr closure = g_gc.New<Closure>(c);
 	if(nUpVals > 0)
 		closure->upvals.resize(nUpVals);
 	return closure;
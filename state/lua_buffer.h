@@ -0,0 +1,40 @@
+#pragma once
+#include "lua_state.h"
+
+// String built by a C function, the counterpart of luaL_Buffer:
+// pieces go into one growing buffer and the result is pushed once
+struct LuaBuffer
+{
+	LuaState* ls;
+	String buf;
+
+	explicit LuaBuffer(LuaState* l) : ls(l) {}
+
+	void AddChar(char c) { buf += c; }
+	void AddString(const String& s) { buf += s; }
+	void AddString(const char* s, size_t len) { buf.append(s, len); }
+
+	// Appends the string or number on the top of the stack and pops it
+	void AddValue()
+	{
+		LuaValue v = ls->stack->Get(-1);
+		if(v.IsString())
+		{
+			buf += v.AsString();
+		}
+		else
+		{
+			panic_cond(v.tag == LUA_TNUMBER, "string expected!");
+			char tmp[MAXNUMBER2STR];
+			buf.append(tmp, NumberToChars(v, tmp));
+		}
+		ls->Pop(1);
+	}
+
+	// Pushes the string built so far, the buffer is left empty
+	void PushResult()
+	{
+		ls->PushString(std::move(buf));
+		buf.clear();
+	}
+};
@@ -0,0 +1,123 @@
+#pragma once
+#include "public.h"
+#include <unordered_set>
+#include <vector>
+
+enum GCMode
+{
+	GC_INCREMENTAL,
+	GC_GENERATIONAL,
+};
+
+enum GCState
+{
+	GCS_PAUSE, // waiting for the allocation debt to start a new cycle
+	GCS_PROPAGATE, // marking the gray objects a few at a time
+	GCS_SWEEP, // freeing the unmarked objects a few at a time
+};
+
+// bytes allocated between two steps of an incremental cycle
+const size_t GC_STEPSIZE = 8 * 1024;
+// objects swept by one step and the work accounted for each of them
+const size_t GC_SWEEPMAX = 64;
+const size_t GC_SWEEPCOST = 16;
+
+// Tracing collector shared by every state and thread.
+// Roots are the main states: their registry and the stacks of every reachable thread,
+// and the constants of every prototype.
+// Collection only runs between two instructions (see LuaState::RunLuaClosure)
+// or from collectgarbage, so all live values are on some stack at that time.
+struct LuaGC
+{
+	// incremental: every object; generational: objects allocated since the last collection
+	LuaObject* allgc;
+	// generational: objects that survived a collection
+	LuaObject* oldgc;
+	// incremental: objects not swept yet in the current cycle
+	LuaObject* sweepgc;
+	std::vector<LuaObject*> gray;
+	// generational: old objects written since the last collection,
+	// and young ones stored into upvalues that the next minor collection keeps
+	std::vector<LuaObject*> touched;
+	std::vector<LuaState*> roots;
+	std::vector<LuaState*> threads;
+	// every existing prototype, their constants are roots
+	std::unordered_set<const Prototype*> protos;
+
+	GCMode mode;
+	GCState state;
+	bool running;
+	bool minor;
+
+	size_t totalbytes;
+	size_t threshold;
+	size_t estimate;
+	size_t sweepAllocated;
+	size_t majorBase;
+
+	int pause;
+	int stepmul;
+	int minormul;
+	int majormul;
+
+	LuaGC();
+
+	template<typename T, typename... Args>
+	T* New(Args&&... args)
+	{
+		T* o = new T(std::forward<Args>(args)...);
+		Link(o);
+		return o;
+	}
+
+	void Link(LuaObject* o);
+	void MarkObject(LuaObject* o);
+	void MarkValue(const LuaValue& v);
+	// Constant strings of a prototype
+	void MarkProto(const Prototype* p);
+	void AddProto(const Prototype* p) { protos.insert(p); }
+	void RemoveProto(const Prototype* p) { protos.erase(p); }
+
+	// A value has been stored into o
+	inline void Barrier(LuaObject* o)
+	{
+		if(o->marked & (GC_BLACK | GC_OLD))
+			_BarrierBack(o);
+	}
+
+	// o has been stored into a closed upvalue. Upvalues are not collectable and the closures
+	// sharing one are unknown, so o itself is kept alive for the closures that may be marked already
+	inline void BarrierForward(LuaObject* o)
+	{
+		if(!(o->marked & (GC_BLACK | GC_OLD)))
+			_BarrierForward(o);
+	}
+
+	inline void CheckGC()
+	{
+		if(totalbytes >= threshold && running)
+			Step();
+	}
+
+	// Returns true when a cycle has just finished
+	bool Step();
+	void FullGC();
+	GCMode SetMode(GCMode m);
+	void AddRoot(LuaState* ls);
+	void RemoveThread(LuaState* ls);
+
+	void _BarrierBack(LuaObject* o);
+	void _BarrierForward(LuaObject* o);
+	void _MarkRoots();
+	size_t _PropagateMark();
+	void _PropagateAll();
+	void _Atomic();
+	bool _SweepStep();
+	void _FinishCycle();
+	void _Free(LuaObject* o);
+	void _MinorGen();
+	void _MajorGen();
+	void _SetGenThreshold();
+};
+
+extern LuaGC g_gc;
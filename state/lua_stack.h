@@ -6,23 +6,62 @@
 #include <vector>
 #include <assert.h>
 
-struct LuaStack
+// Activation record of a call, its registers are a window of the thread stack
+struct CallInfo
 {
-	std::vector<LuaValuePtr> slots;
-	std::unordered_map<int, UpValue> openuvs;
-	LuaValueArray varargs;
-	LuaStackPtr prev;
 	ClosurePtr closure;
+	// slot of the called function, the registers start right after it at base
+	int func;
+	int base;
+	int pc;
+	// results wanted by the caller, -1 means all of them
+	int nResults;
+	LuaValueArray varargs;
+	CallInfo* prev;
+	// kept when the call returns so that the next call reuses it
+	CallInfo* next;
+
+	CallInfo()
+	{
+		closure = nullptr;
+		func = base = pc = nResults = 0;
+		prev = next = nullptr;
+	}
+};
+
+// Value stack of a thread, shared by every call running in it
+struct LuaStack
+{
+	// values are stored in place, open upvalues point at them
+	std::vector<LuaValue> slots;
+	// the running call, baseCi when only C code is running
+	CallInfo* ci;
+	CallInfo baseCi;
 	LuaState* state;
+	// first free slot
 	int top;
-	int pc;
+	// upvalues still pointing at slots, sorted by level with the highest first
+	UpValuePtr openupval;
+
+	LuaStack(int size, LuaState* state);
+	~LuaStack();
+	LuaStack(const LuaStack&) = delete;
+	LuaStack& operator=(const LuaStack&) = delete;
+
+	// New frame whose function sits at slot func
+	CallInfo* PushFrame(const ClosurePtr& c, int func, int nResults);
+	void PopFrame();
+	// The open upvalue of slot level, created if no closure captured it yet
+	UpValuePtr FindUpvalue(int level);
+	// Close the open upvalues from slot level up
+	void CloseUpvalues(int level);
 
-	LuaStack();
 	void Check(int n);
 	void Push(const LuaValue& value);
-	LuaValuePtr Pop();
+	LuaValue Pop();
 	void PushN(const LuaValueArray& vals, int n);
 	LuaValueArray PopN(int n);
+	// idx here is relative to the running call
 	int AbsIndex(int idx) const;
 	// idx here is absoulte index [1,n]
 	bool IsValid(int idx) const;
@@ -32,15 +71,11 @@ struct LuaStack
 	void Set(int idx, const LuaValue& value);
 	// from and to is internal index
 	void _Reverse(size_t from, size_t to);
+	// Point the open upvalues at the slots again after they moved
+	void _FixUpvalues();
 };
 
 inline LuaStackPtr NewLuaStack(int size, LuaState* state)
 {
-	LuaStackPtr ret = LuaStackPtr(new LuaStack());
-	ret->slots.resize(size);
-	for(int i = 0; i < size; ++i)
-		ret->slots[i] = LuaValue::NilPtr;
-	ret->top = 0;
-	ret->state = state;
-	return ret;
-}
\ No newline at end of file
+	return LuaStackPtr(new LuaStack(size, state));
+}
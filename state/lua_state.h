@@ -5,6 +5,8 @@
 #include "closure.h"
 #include "binchunk/binary_chunk.h"
 #include "binchunk/reader.h"
+#include "binchunk/writer.h"
+#include "binchunk/chunk_cache.h"
 #include "compiler/compiler.h"
 #include <setjmp.h>
 
@@ -38,13 +40,19 @@ void PrintStack(LuaState& state);
 // todo
 extern std::unordered_map<CFunction, String> cFuncNames;
 
-struct LuaState
+// Instructions run by every state, only counted when built with LUA_COUNT_INSTRUCTIONS
+extern UInt64 g_instcount;
+
+struct LuaState : public LuaObject
 {
 	LuaStackPtr stack;
 	LuaTablePtr registry;
 	int coStatus;
 
 	LuaState();
+	~LuaState();
+	void Traverse(LuaGC* gc) override;
+	size_t Size() const override { return sizeof(LuaState) + sizeof(LuaStack); }
 
 	int GetTop() const;
 	int AbsIndex(int idx) const;
@@ -62,6 +70,7 @@ struct LuaState
 	void PushInteger(Int64 n);
 	void PushNumber(Float64 n);
 	void PushString(const String& str);
+	void PushString(String&& str);
 	LuaType Type(int idx) const;
 	bool IsNone(int idx) const;
 	bool IsNil(int idx) const;
@@ -82,9 +91,11 @@ struct LuaState
 	std::tuple<String, bool> ToStringX(int idx);
 	String ToString(int idx);
 	void Arith(ArithOp op);
+	LuaValue _ArithValue(const LuaValue& a, const LuaValue& b, ArithOp op);
 	bool Compare(int idx1, int idx2, CompareOp op);
 	bool RawEqual(int idx1, int idx2);
 	void Len(int idx);
+	LuaValue _LenValue(const LuaValue& val);
 	int RawLen(int idx);
 	void Concat(int n);
 	void PushFString(const char* fmt, ...);
@@ -95,6 +106,8 @@ struct LuaState
 	void CreateTable(int nArr, int nRec);
 	void NewTable();
 	LuaType _GetTable(const LuaValue& t, const LuaValue& k, bool raw);
+	LuaValue _GetTableValue(const LuaValue& t, const LuaValue& k, bool raw);
+	LuaValue _GetTableValueCached(const LuaValue& t, const LuaValue& k, InlineCache& ic);
 	LuaType GetTable(int idx);
 	LuaType GetField(int idx, const String& k);
 	LuaType RawGetField(int idx, const String& k);
@@ -102,20 +115,27 @@ struct LuaState
 	LuaType RawGet(int idx);
 	LuaType RawGetI(int idx, Int64 k);
 	void _SetTable(const LuaValue& t, const LuaValue& k, const LuaValue& v, bool raw);
+	void _SetTableCached(const LuaValue& t, const LuaValue& k, const LuaValue& v, InlineCache& ic);
 	void SetTable(int idx);
 	void SetField(int idx, const String& k);
 	void SetI(int idx, Int64 i);
 	void RawSet(int idx);
 	void RawSetI(int idx, Int64 i);
-	void PushLuaStack(LuaStackPtr s);
-	void PopLuaStack();
-	bool IsBinaryChunk(const ByteArray& chunk);
-	int Load(const ByteArray& chunk, const String& chunkName, const String& mode);
-	void RunLuaClosure();
+	bool IsBinaryChunk(const Byte* chunk, size_t size);
+	// chunk is only read during the call
+	int Load(const Byte* chunk, size_t size, const String& chunkName, const String& mode);
+	// Writes the Lua function on the top of the stack as a binary chunk, non zero if it is not one
+	int Dump(ByteArray& chunk, bool strip);
+	// Returns the slot of the first result
+	int RunLuaClosure();
 	void CallLuaClosure(int nArgs, int nResults, ClosurePtr c);
 	void CallCClosure(int nArgs, int nResults, ClosurePtr c);
 	void Call(int nArgs, int nResults);
-	void TailCall(int idx, int nArgs);
+	// Returns true when a Lua function took over the running frame
+	bool TailCall(int nArgs);
+	ClosurePtr _CallTarget(int& nArgs);
+	void _InitLuaFrame(CallInfo* ci, int nArgs, int oldTop);
+	void _PostCall(int firstResult);
 	void PushCClosure(CFunction c, int n);
 	void PushCFunction(CFunction c);
 	bool IsCFunction(int idx);
@@ -131,6 +151,7 @@ struct LuaState
 	bool Next(int idx);
 	int Error();
 	int PCall(int nArgs, int nResults, int msgh);
+	int GC(int what, int data);
 	/*
 	interfaces for luavm
 	*/
@@ -142,6 +163,7 @@ struct LuaState
 	int RegisterCount() const;
 	void LoadVararg(int n);
 	void LoadProto(int idx);
+	ClosurePtr _NewClosure(int idx);
 	void CloseUpvalues(int a);
 	/*
 	interfaces for auxlib
@@ -193,7 +215,7 @@ struct LuaState
 	bool GetStack();
 	bool PushThread();
 
-	void _FixYieldStack(int nArgs);
+	void _FinishCall();
 
 	using FunctionCall = void(LuaState::*)(int, int); // void(LuaState::* Function)(int, int)
 	void _Resume(int nArgs, int nResults);
@@ -201,9 +223,13 @@ struct LuaState
 	int _ProtectedRun(FunctionCall func, int nArgs, int nResults);
 };
 
+inline LuaValue::LuaValue(const LuaStatePtr& s) { _SetObject(LUA_TTHREAD, s.get()); }
+inline LuaState* LuaValue::AsThread() const { return IsThread() ? static_cast<LuaState*>(gc) : nullptr; }
+
 inline LuaStatePtr NewLuaState()
 {
-	LuaStatePtr ls = LuaStatePtr(new LuaState());
+	LuaStatePtr ls = g_gc.New<LuaState>();
+	g_gc.AddRoot(ls.get());
 
 	LuaValue mainThread = LuaValue(ls);
 	LuaValue global = LuaValue(NewLuaTable(0, 0));
@@ -213,7 +239,7 @@ inline LuaStatePtr NewLuaState()
 	registry->Put(LuaValue(LUA_RIDX_GLOBALS), global);
 
 	ls->registry = registry;
-	ls->PushLuaStack(NewLuaStack(LUA_MINSTACK, ls.get()));
+	ls->stack = NewLuaStack(LUA_MINSTACK, ls.get());
 
 	return ls;
 }
\ No newline at end of file
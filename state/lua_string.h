@@ -0,0 +1,114 @@
+#pragma once
+#include "public.h"
+#include "lua_gc.h"
+#include <vector>
+
+// strings up to this length are interned, equal short strings are the same object
+const size_t LUAI_MAXSHORTLEN = 40;
+
+// Heap part of a string value, shared between every copy of the value
+struct LuaString : public LuaObject
+{
+	String str;
+	size_t hash;
+	// next string in the same bucket of the string table
+	LuaString* hnext;
+	bool isShort;
+
+	LuaString(const String& s, size_t h) : str(s), hash(h), hnext(nullptr), isShort(s.length() <= LUAI_MAXSHORTLEN) {}
+	LuaString(String&& s, size_t h) : str(std::move(s)), hash(h), hnext(nullptr), isShort(str.length() <= LUAI_MAXSHORTLEN) {}
+	~LuaString();
+
+	size_t Size() const override { return sizeof(LuaString) + str.capacity(); }
+
+	static size_t _BKDR(const char* pData, size_t uLen)
+	{
+		size_t seed = 31; // 31 131 1313 13131 131313 etc.. 37
+		size_t hash = 0;
+		/* variant with the hash unrolled eight times */
+		for (; uLen >= 8; uLen -= 8)
+		{
+			hash = hash * seed + *pData++;
+			hash = hash * seed + *pData++;
+			hash = hash * seed + *pData++;
+			hash = hash * seed + *pData++;
+			hash = hash * seed + *pData++;
+			hash = hash * seed + *pData++;
+			hash = hash * seed + *pData++;
+			hash = hash * seed + *pData++;
+		}
+		switch (uLen)
+		{
+			case 7: hash = hash * seed + *pData++; /* fallthrough... */
+			case 6: hash = hash * seed + *pData++; /* fallthrough... */
+			case 5: hash = hash * seed + *pData++; /* fallthrough... */
+			case 4: hash = hash * seed + *pData++; /* fallthrough... */
+			case 3: hash = hash * seed + *pData++; /* fallthrough... */
+			case 2: hash = hash * seed + *pData++; /* fallthrough... */
+			case 1: hash = hash * seed + *pData++; break;
+			case 0: break;
+		}
+
+		return hash;
+	}
+};
+
+inline bool EqualString(const LuaString* a, const LuaString* b)
+{
+	// short strings are interned so only long strings need the content check
+	return a == b || (!a->isShort && !b->isShort && a->hash == b->hash && a->str == b->str);
+}
+
+// Weak set of every short string, chained through LuaString::hnext
+struct StringTable
+{
+	std::vector<LuaString*> buckets;
+	size_t count;
+
+	StringTable();
+	LuaString* Find(const String& s, size_t hash) const;
+	void Insert(LuaString* s);
+	void Remove(LuaString* s);
+	void _Resize(size_t n);
+};
+
+extern StringTable g_strt;
+
+// Returns the interned object for short strings, a new object otherwise
+LuaString* NewLuaString(const String& s);
+// Same, a long string takes over the storage of s
+LuaString* NewLuaString(String&& s);
+
+// Metamethod events, the names are interned once and never collected
+enum TMS
+{
+	TM_INDEX,
+	TM_NEWINDEX,
+	TM_GC,
+	TM_MODE,
+	TM_LEN,
+	TM_EQ,
+	TM_ADD,
+	TM_SUB,
+	TM_MUL,
+	TM_MOD,
+	TM_POW,
+	TM_DIV,
+	TM_IDIV,
+	TM_BAND,
+	TM_BOR,
+	TM_BXOR,
+	TM_SHL,
+	TM_SHR,
+	TM_UNM,
+	TM_BNOT,
+	TM_LT,
+	TM_LE,
+	TM_CONCAT,
+	TM_CALL,
+	TM_N,
+};
+
+extern LuaString* const g_tmnames[TM_N];
+
+inline LuaString* MetaName(TMS event) { return g_tmnames[event]; }
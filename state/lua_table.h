@@ -1,17 +1,37 @@
 #pragma once
 #include "lua_value.h"
 #include <vector>
-#include <map>
 #include <cmath>
 
-struct LuaTable
+// 2^MAXABITS is the largest size of the array part
+const int MAXABITS = 31;
+
+struct LuaTable : public LuaObject
 {
-	std::vector<LuaValuePtr> arr;
-	std::unordered_map<LuaValue, LuaValuePtr> map;
-	std::unordered_map<LuaValue, LuaValue> keys;
+	struct Node
+	{
+		// LUA_TNONE marks a free slot, a key with a nil value is a dead entry
+		LuaValue key;
+		LuaValue val;
+	};
+
+	// array part, arr[i] holds the value of key i + 1
+	std::vector<LuaValue> arr;
+	// hash part, open addressing with linear probing, size is 0 or a power of 2
+	std::vector<Node> node;
+	// slots of the hash part holding a key, dead entries included
+	size_t nodeUsed = 0;
 	LuaTablePtr metatable;
+	// bit 1 << e is set once the metamethod e is known to be absent from this table,
+	// cleared by every assignment
+	mutable UInt32 flags = 0;
+	static_assert(TM_N <= 32, "flags has a bit per metamethod");
 
-	static const LuaTablePtr NilPtr;
+	void Traverse(LuaGC* gc) override;
+	size_t Size() const override
+	{
+		return sizeof(LuaTable) + arr.capacity() * sizeof(LuaValue) + node.capacity() * sizeof(Node);
+	}
 
 	static LuaValue _FloatToInteger(const LuaValue& v)
 	{
@@ -26,173 +46,385 @@ struct LuaTable
 		return v;
 	}
 
-	const LuaValuePtr _GetFromMap(const LuaValue& key) const
+	// Index of key in the hash part, -1 if absent, h is key.Hash()
+	int _FindNode(const LuaValue& key, size_t h) const
+	{
+		if(node.empty())
+			return -1;
+		size_t mask = node.size() - 1;
+		size_t i = h & mask;
+		while(node[i].key.tag != LUA_TNONE)
+		{
+			if(node[i].key == key)
+				return (int)i;
+			i = (i + 1) & mask;
+		}
+		return -1;
+	}
+
+	// Key must not be in the table and the hash part must have room for it
+	void _InsertNode(const LuaValue& key, const LuaValue& val, size_t h)
+	{
+		size_t mask = node.size() - 1;
+		size_t i = h & mask;
+		// reuse a dead entry on the way
+		while(node[i].key.tag != LUA_TNONE && node[i].val.tag != LUA_TNIL)
+			i = (i + 1) & mask;
+		if(node[i].key.tag == LUA_TNONE)
+			++nodeUsed;
+		node[i].key = key;
+		node[i].val = val;
+	}
+
+	const LuaValue& Get(const LuaValue& _key) const
+	{
+		if(_key.IsInt64())
+			return GetInt(_key.integer);
+		LuaValue key = _FloatToInteger(_key);
+		if(key.IsInt64())
+			return GetInt(key.integer);
+		int n = _FindNode(key, key.Hash());
+		return n >= 0 ? node[n].val : LuaValue::Nil;
+	}
+
+	const LuaValue& GetInt(Int64 k) const
 	{
-		auto it = map.find(key);
-		if(it != map.end())
-			return it->second;
-		return LuaValue::NilPtr;
+		if((UInt64)k - 1 < (UInt64)arr.size())
+			return arr[(size_t)(k - 1)];
+		LuaValue key(k);
+		int n = _FindNode(key, key.Hash());
+		return n >= 0 ? node[n].val : LuaValue::Nil;
 	}
 
-	void _EraseKeyFromMap(const LuaValue& key)
+	// Lookup of a string key, hint is the slot where it was found last time and is updated
+	const LuaValue& GetStr(const LuaValue& key, int& hint) const
 	{
-		auto it = map.find(key);
-		if(it != map.end())
-			map.erase(it);
+		if((size_t)hint < node.size() && node[hint].key.tag == LUA_TSTRING && node[hint].key.gc == key.gc)
+			return node[hint].val;
+		int n = _FindNode(key, key.Hash());
+		if(n < 0)
+			return LuaValue::Nil;
+		hint = n;
+		return node[n].val;
 	}
 
-	// Erase the hole in the array
-	void _ShrinkArray()
+	// Assignment to a string key already holding a value, false if there is none.
+	// hint works as in GetStr
+	bool ReplaceStr(const LuaValue& key, const LuaValue& val, int& hint)
 	{
-		size_t size = arr.size();
-		while(size > 0)
+		if(!((size_t)hint < node.size() && node[hint].key.tag == LUA_TSTRING && node[hint].key.gc == key.gc))
 		{
-			const LuaValue& val = *arr[size - 1];
-			if(val != LuaValue::Nil)
-				break;
-			--size;
+			int n = _FindNode(key, key.Hash());
+			if(n < 0)
+				return false;
+			hint = n;
 		}
-		arr.resize(size);
+		if(node[hint].val.tag == LUA_TNIL)
+			return false;
+		g_gc.Barrier(this);
+		flags = 0;
+		node[hint].val = val;
+		return true;
 	}
 
-	// Start from the end index of the array to search for Value that
-	// can be appended to the array from the Map
-	void _ExpandArray()
+	void Put(const LuaValue& _key, const LuaValue& val)
 	{
-		size_t idx = arr.size() + 1;
-		while(true)
+		if(_key.tag == LUA_TNIL)
+			panic("table index is nil!");
+		if(_key.IsFloat64() && std::isnan(_key.number))
+			panic("table index is NAN!");
+
+		g_gc.Barrier(this);
+		flags = 0;
+		LuaValue key = _FloatToInteger(_key);
+
+		if(key.IsInt64() && (UInt64)key.integer - 1 < (UInt64)arr.size())
 		{
-			auto it = map.find(LuaValue((Int64)idx));
-			if(it == map.end())
-			{
-				break;
-			}
-			else
+			arr[(size_t)(key.integer - 1)] = val;
+			return;
+		}
+
+		size_t h = key.Hash();
+		int n = _FindNode(key, h);
+		if(n >= 0)
+		{
+			node[n].val = val;
+			return;
+		}
+		// assigning nil to an absent key
+		if(val.tag == LUA_TNIL)
+			return;
+
+		// keep the load factor of the hash part under 3/4
+		if((nodeUsed + 1) * 4 > node.size() * 3)
+		{
+			// val may point into the storage that is about to move
+			LuaValue v = val;
+			_Rehash(key);
+			// the key may belong to the array part now
+			Put(key, v);
+			return;
+		}
+		_InsertNode(key, val, h);
+	}
+
+	static bool _ArrayIndex(const LuaValue& key, size_t& k)
+	{
+		if(key.IsInt64() && key.integer > 0 && key.integer <= ((Int64)1 << MAXABITS))
+		{
+			k = (size_t)key.integer;
+			return true;
+		}
+		return false;
+	}
+
+	// nums[i] counts the integer keys k with 2^(i-1) < k <= 2^i
+	static int _CountInt(const LuaValue& key, size_t* nums)
+	{
+		size_t k = 0;
+		if(_ArrayIndex(key, k))
+		{
+			int lg = 0;
+			while(((size_t)1 << lg) < k)
+				++lg;
+			++nums[lg];
+			return 1;
+		}
+		return 0;
+	}
+
+	// Largest n such that more than half of the slots 1..n would be in use
+	static size_t _ComputeSizes(size_t* nums, size_t& na)
+	{
+		size_t a = 0;
+		size_t nArr = 0;
+		size_t optimal = 0;
+		size_t twotoi = 1;
+		for(int i = 0; i <= MAXABITS && na > twotoi / 2; ++i, twotoi *= 2)
+		{
+			if(nums[i] > 0)
 			{
-				LuaValuePtr val = it->second;
-				it = map.erase(it);
-				arr.push_back(val);
+				a += nums[i];
+				if(a > twotoi / 2)
+				{
+					optimal = twotoi;
+					nArr = a;
+				}
 			}
 		}
+		na = nArr;
+		return optimal;
 	}
 
-	const LuaValuePtr Get(const LuaValue& _key) const
+	void _Rehash(const LuaValue& extraKey)
 	{
-		LuaValue key = _FloatToInteger(_key);
-		if(key.IsInt64())
+		size_t nums[MAXABITS + 1] = { 0 };
+		size_t na = 0;
+		size_t total = 0;
+
+		// keys in the array part
+		size_t lim = 1;
+		size_t i = 1;
+		for(int lg = 0; lg <= MAXABITS; ++lg, lim *= 2)
+		{
+			size_t lc = 0;
+			size_t end = std::min(lim, arr.size());
+			if(i > end)
+				break;
+			for(; i <= end; ++i)
+			{
+				if(arr[i - 1].tag != LUA_TNIL)
+					++lc;
+			}
+			nums[lg] += lc;
+			na += lc;
+		}
+		total += na;
+
+		// keys in the hash part
+		for(const Node& n : node)
 		{
-			size_t idx = (size_t)key.integer;
-			if(idx >= 1 && idx <= arr.size())
+			if(n.key.tag != LUA_TNONE && n.val.tag != LUA_TNIL)
 			{
-				return arr[idx - 1];
+				na += _CountInt(n.key, nums);
+				++total;
 			}
 		}
-		return _GetFromMap(key);
+
+		na += _CountInt(extraKey, nums);
+		++total;
+
+		size_t arraySize = _ComputeSizes(nums, na);
+		Resize(arraySize, total - na);
 	}
 
-	void Put(const LuaValue& _key, const LuaValue& _val)
+	void Resize(size_t nArr, size_t nRec)
 	{
-		if(_key == LuaValue::Nil)
-			panic("table index is nil!");
-		if(_key.IsFloat64() && std::isnan(_key.number))
-			panic("table index is NAN!");
+		size_t nodeSize = 0;
+		if(nRec > 0)
+		{
+			nodeSize = 4;
+			while(nodeSize * 3 < nRec * 4)
+				nodeSize *= 2;
+		}
 
-		LuaValue key = _FloatToInteger(_key);
-		LuaValuePtr val = NewLuaValue(_val);
+		std::vector<Node> oldNode;
+		oldNode.swap(node);
+		node.resize(nodeSize);
+		nodeUsed = 0;
 
-		if(key.IsInt64())
+		std::vector<LuaValue> extra;
+		if(nArr < arr.size())
 		{
-			size_t idx = (size_t)key.integer;
-			if(idx >= 1)
+			for(size_t i = nArr; i < arr.size(); ++i)
 			{
-				if(idx <= arr.size())
-				{
-					arr[idx - 1] = val;
-					if(idx == arr.size() && *val == LuaValue::Nil)
-						_ShrinkArray();
-					return;
-				}
-				else if(idx == arr.size() + 1)
+				if(arr[i].tag != LUA_TNIL)
 				{
-					_EraseKeyFromMap(key);
-					if(*val != LuaValue::Nil)
-					{
-						arr.push_back(val);
-						_ExpandArray();
-					}
-					return;
+					extra.push_back(LuaValue((Int64)i + 1));
+					extra.push_back(arr[i]);
 				}
 			}
 		}
+		arr.resize(nArr, LuaValue::Nil);
 
-		if(*val != LuaValue::Nil)
+		for(size_t i = 0; i < extra.size(); i += 2)
+			_InsertNode(extra[i], extra[i + 1], extra[i].Hash());
+		for(const Node& n : oldNode)
 		{
-			map[key] = val;
-		}
-		else
-		{
-			_EraseKeyFromMap(key);
+			if(n.key.tag == LUA_TNONE || n.val.tag == LUA_TNIL)
+				continue;
+			if(n.key.IsInt64() && (UInt64)n.key.integer - 1 < (UInt64)arr.size())
+				arr[(size_t)(n.key.integer - 1)] = n.val;
+			else
+				_InsertNode(n.key, n.val, n.key.Hash());
 		}
 	}
 
-	size_t Len() const { return arr.size(); }
-
-	bool HasMetafield(const String& fieldName) const
+	// A border of the table, same search as luaH_getn
+	size_t Len() const
 	{
-		if(metatable)
+		size_t j = arr.size();
+		if(j > 0 && arr[j - 1].tag == LUA_TNIL)
 		{
-			return metatable->Get(LuaValue(fieldName)) != LuaValue::NilPtr;
+			// binary search for a border inside the array part
+			size_t i = 0;
+			while(j - i > 1)
+			{
+				size_t m = (i + j) / 2;
+				if(arr[m - 1].tag == LUA_TNIL)
+					j = m;
+				else
+					i = m;
+			}
+			return i;
 		}
-		return false;
+		if(node.empty())
+			return j;
+		return _UnboundSearch(j);
 	}
 
-	void _InitKeys()
+	size_t _UnboundSearch(size_t j) const
 	{
-		LuaValue key = LuaValue::Nil;
-		for(size_t i = 0; i < arr.size(); ++i)
+		size_t i = j;
+		++j;
+		while(GetInt((Int64)j).tag != LUA_TNIL)
 		{
-			LuaValue nextKey = LuaValue((Int64)i + 1);
-			keys.insert({key, nextKey});
-			key = nextKey;
+			i = j;
+			if(j > ((size_t)1 << 62))
+			{
+				// table was built with bad purposes, resort to linear search
+				i = 1;
+				while(GetInt((Int64)i).tag != LUA_TNIL)
+					++i;
+				return i - 1;
+			}
+			j *= 2;
 		}
-		for(const auto& pair : map)
+		while(j - i > 1)
 		{
-			const LuaValue& mapKey = pair.first;
-			keys.insert({key, mapKey});
-			key = mapKey;
+			size_t m = (i + j) / 2;
+			if(GetInt((Int64)m).tag == LUA_TNIL)
+				j = m;
+			else
+				i = m;
 		}
+		return i;
 	}
 
-	LuaValue NextKey(const LuaValue& key)
+	// Metamethod event of this table used as a metatable, hint works as in GetStr
+	const LuaValue& GetMetamethod(TMS event, int& hint) const
 	{
-		if(key == LuaValue::Nil || ((arr.size() + map.size() > 0) && keys.empty()))
-		{
-			_InitKeys();
-		}
-
-		auto it = keys.find(key);
-		if(it != keys.end())
-			return it->second;
-		else
+		if(flags & (1u << event))
 			return LuaValue::Nil;
+		const LuaValue& mm = GetStr(LuaValue(MetaName(event)), hint);
+		if(mm.tag == LUA_TNIL)
+			flags |= 1u << event;
+		return mm;
 	}
-};
 
-inline LuaTablePtr NewLuaTable(int nArr, int nRec)
-{
-	LuaTablePtr t = LuaTablePtr(new LuaTable());
+	const LuaValue& GetMetamethod(TMS event) const
+	{
+		int hint = -1;
+		return GetMetamethod(event, hint);
+	}
+
+	bool HasMetafield(TMS event) const
+	{
+		return metatable && metatable->GetMetamethod(event).tag != LUA_TNIL;
+	}
+
+	// Slot index after key: 0 for nil, k for the array key k, arr.size() + n + 1 for node n
+	size_t _FindIndex(const LuaValue& _key) const
+	{
+		if(_key.tag == LUA_TNIL)
+			return 0;
+		LuaValue key = _FloatToInteger(_key);
+		if(key.IsInt64() && (UInt64)key.integer - 1 < (UInt64)arr.size())
+			return (size_t)key.integer;
+		int n = _FindNode(key, key.Hash());
+		if(n < 0)
+			panic("invalid key to 'next'");
+		return arr.size() + (size_t)n + 1;
+	}
 
-	t->arr.resize(nArr);
-	for(int i = 0; i < nArr; ++i)
+	// Walks the slots in order, dead entries are skipped but still valid keys
+	bool Next(const LuaValue& key, LuaValue& nextKey, LuaValue& nextVal) const
 	{
-		t->arr[i] = LuaValue::NilPtr;
+		size_t i = _FindIndex(key);
+		for(; i < arr.size(); ++i)
+		{
+			if(arr[i].tag != LUA_TNIL)
+			{
+				nextKey = LuaValue((Int64)i + 1);
+				nextVal = arr[i];
+				return true;
+			}
+		}
+		for(i -= arr.size(); i < node.size(); ++i)
+		{
+			if(node[i].key.tag != LUA_TNONE && node[i].val.tag != LUA_TNIL)
+			{
+				nextKey = node[i].key;
+				nextVal = node[i].val;
+				return true;
+			}
+		}
+		return false;
 	}
+};
 
+inline LuaValue::LuaValue(const LuaTablePtr& t) { _SetObject(LUA_TTABLE, t.get()); }
+inline LuaTable* LuaValue::AsTable() const { return IsTable() ? static_cast<LuaTable*>(gc) : nullptr; }
+
+inline LuaTablePtr NewLuaTable(int nArr, int nRec)
+{
+	LuaTablePtr t = g_gc.New<LuaTable>();
+	t->Resize((size_t)std::max(nArr, 0), (size_t)std::max(nRec, 0));
 	DEBUG_PRINT("new table: 0x%x nArr:%d nRec:%d", (size_t)t.get(), nArr, nRec);
 	return t;
 }
 
 void SetMetatable(LuaValue& val, LuaTablePtr mt, LuaState* ls);
 LuaTablePtr GetMetatable(const LuaValue& val, const LuaState* ls);
-std::tuple<LuaValue, bool> CallMetamethod(const LuaValue& a, const LuaValue& b,	const String& mmName, LuaState* ls);
-LuaValue GetMetafield(const LuaValue& val, const String& fieldName, const LuaState* ls);
\ No newline at end of file
+std::tuple<LuaValue, bool> CallMetamethod(const LuaValue& a, const LuaValue& b,	TMS mmName, LuaState* ls);
+LuaValue GetMetafield(const LuaValue& val, TMS event, const LuaState* ls);
\ No newline at end of file
@@ -1,28 +1,29 @@
 #pragma once
 #include "api/consts.h"
 #include "number/parser.h"
+#include "lua_string.h"
 #include <memory>
+#include <cstdio>
 #include <unordered_map>
 
+// 16 bytes: tag and float flag packed in the first word, payload in the second.
+// Strings, tables, closures and threads are all held behind the gc pointer,
+// copying a value never touches the object.
 struct LuaValue
 {
-	LuaType tag = LUA_TNONE;
+	LuaType tag;
+	bool isfloat;
 	union
 	{
 		bool boolean;
-		Int64 integer = 0;
+		Int64 integer;
 		Float64 number;
+		LuaObject* gc;
 	};
-	bool isfloat = false;
-	std::string str;
-	LuaTablePtr table = nullptr;
-	ClosurePtr closure = nullptr;
-	LuaStatePtr state = nullptr;
 
 	const static LuaValue NoValue;
 	const static LuaValue Nil;
-	const static LuaValuePtr NoValuePtr;
-	const static LuaValuePtr NilPtr;
+	const static String EmptyString;
 
 	inline bool IsInt64() const { return tag == LUA_TNUMBER && !isfloat; }
 	inline bool IsFloat64() const { return tag == LUA_TNUMBER && isfloat; }
@@ -31,46 +32,53 @@ struct LuaValue
 	inline bool IsTable() const { return tag == LUA_TTABLE; }
 	inline bool IsClosure() const { return tag == LUA_TFUNCTION; }
 	inline bool IsThread() const { return tag == LUA_TTHREAD; }
+	inline bool IsCollectable() const { return tag >= LUA_TSTRING; }
 
-	static size_t _BKDR(const char* pData, size_t uLen)
-	{
-		size_t seed = 31; // 31 131 1313 13131 131313 etc.. 37
-		size_t hash = 0; 
-		/* variant with the hash unrolled eight times */ 
-		for (; uLen >= 8; uLen -= 8)
-		{ 
-			hash = hash * seed + *pData++;
-			hash = hash * seed + *pData++;
-			hash = hash * seed + *pData++;
-			hash = hash * seed + *pData++;
-			hash = hash * seed + *pData++;
-			hash = hash * seed + *pData++;
-			hash = hash * seed + *pData++;
-			hash = hash * seed + *pData++;
-		} 
-		switch (uLen)
+	inline LuaString* AsLuaString() const { return static_cast<LuaString*>(gc); }
+	inline const String& AsString() const { return IsString() ? AsLuaString()->str : EmptyString; }
+	// Defined next to the object types, they are incomplete here
+	inline LuaTable* AsTable() const;
+	inline Closure* AsClosure() const;
+	inline LuaState* AsThread() const;
+
+	inline size_t Hash() const
+	{
+		switch(tag)
 		{
-			case 7: hash = hash * seed + *pData++; /* fallthrough... */
-			case 6: hash = hash * seed + *pData++; /* fallthrough... */
-			case 5: hash = hash * seed + *pData++; /* fallthrough... */
-			case 4: hash = hash * seed + *pData++; /* fallthrough... */
-			case 3: hash = hash * seed + *pData++; /* fallthrough... */
-			case 2: hash = hash * seed + *pData++; /* fallthrough... */
-			case 1: hash = hash * seed + *pData++; break; 
-			case 0: break;
+			case LUA_TBOOLEAN: return boolean ? 1 : 0;
+			// integers and floats share the payload word, compare their bits
+			case LUA_TNUMBER: return _Mix((UInt64)integer);
+			case LUA_TSTRING: return AsLuaString()->hash;
+			default: return IsCollectable() ? _Mix((UInt64)(size_t)gc) : 0;
 		}
-	
-		return hash;
 	}
 
-	size_t Hash() const;
+	// Raw key equality: 1 and 1.0 are different values here, tables normalize
+	// float keys before looking them up. Objects compare by identity.
+	inline bool operator==(const LuaValue& rhs) const
+	{
+		if(tag != rhs.tag)
+			return false;
+		switch(tag)
+		{
+			case LUA_TNONE:
+			case LUA_TNIL: return true;
+			case LUA_TBOOLEAN: return boolean == rhs.boolean;
+			case LUA_TNUMBER: return isfloat == rhs.isfloat && integer == rhs.integer;
+			case LUA_TSTRING: return EqualString(AsLuaString(), rhs.AsLuaString());
+			default: return gc == rhs.gc;
+		}
+	}
+	inline bool operator!=(const LuaValue& rhs) const { return !(*this == rhs); }
 
-	bool operator==(const LuaValue& rhs) const { return Hash() == rhs.Hash(); }
-	bool operator<(const LuaValue& rhs) const { return Hash() < rhs.Hash(); }
-	bool operator<=(const LuaValue& rhs) const { return Hash() <= rhs.Hash(); }
-	bool operator!=(const LuaValue& rhs) const { return !(*this == rhs); }
-	bool operator>(const LuaValue& rhs) const { return !(*this <= rhs); }
-	bool operator>=(const LuaValue& rhs) const { return !(*this < rhs); }
+	static inline size_t _Mix(UInt64 x)
+	{
+		// pointers and float bits have their low bits mostly zero
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdULL;
+		x ^= x >> 33;
+		return (size_t)x;
+	}
 
 	LuaValue(const LuaValue& rhs) = default;
 	LuaValue(LuaValue&& rhs) = default;
@@ -94,6 +102,7 @@ struct LuaValue
 	explicit LuaValue(bool value)
 	{
 		tag = LUA_TBOOLEAN;
+		integer = 0;
 		boolean = value;
 		isfloat = false;
 	}
@@ -115,37 +124,39 @@ struct LuaValue
 	explicit LuaValue(const String& value)
 	{
 		tag = LUA_TSTRING;
-		integer = 0;
-		str = value;
+		gc = NewLuaString(value);
 		isfloat = false;
 	}
 
-	explicit LuaValue(LuaTablePtr t)
+	explicit LuaValue(String&& value)
 	{
-		tag = LUA_TTABLE;
-		integer = 0;
-		table = t;
+		tag = LUA_TSTRING;
+		gc = NewLuaString(std::move(value));
 		isfloat = false;
 	}
 
-	explicit LuaValue(ClosurePtr c)
+	explicit LuaValue(LuaString* value)
 	{
-		tag = LUA_TFUNCTION;
-		integer = 0;
-		closure = c;
+		tag = LUA_TSTRING;
+		gc = value;
 		isfloat = false;
 	}
 
-	explicit LuaValue(LuaStatePtr s)
+	explicit LuaValue(const LuaTablePtr& t);
+	explicit LuaValue(const ClosurePtr& c);
+	explicit LuaValue(const LuaStatePtr& s);
+
+	// Shared by the object constructors above
+	inline void _SetObject(LuaType _tag, LuaObject* obj)
 	{
-		tag = LUA_TTHREAD;
-		integer = 0;
-		state = s;
+		tag = _tag;
 		isfloat = false;
+		gc = obj;
 	}
 };
 
-inline LuaValuePtr NewLuaValue(const LuaValue& val) { return LuaValuePtr(new LuaValue(val)); }
+static_assert(sizeof(LuaValue) == 16, "LuaValue should be a 16 bytes tagged value");
+
 using LuaValueArray = std::vector<LuaValue>;
 
 namespace std
@@ -177,7 +188,7 @@ inline std::tuple<Float64, bool> ConvertToFloat(const LuaValue& val)
 			else
 				return std::make_tuple((Float64)val.integer, true);
 		}
-		case LUA_TSTRING: return ParseFloat(val.str);
+		case LUA_TSTRING: return ParseFloat(val.AsString());
 		default: return std::make_tuple(0, false);
 	}
 }
@@ -193,7 +204,18 @@ inline std::tuple<Int64, bool> ConvertToInteger(const LuaValue& val)
 			else
 				return std::make_tuple(val.integer, true);
 		}
-		case LUA_TSTRING: return StringToInteger(val.str);
+		case LUA_TSTRING: return StringToInteger(val.AsString());
 		default: return std::make_tuple(0, false);
 	}
+}
+
+// Room for the text of any number, "%f" of the largest double takes 317 characters
+const int MAXNUMBER2STR = 320;
+
+// Writes the text tostring and concatenation give to the number val into buf, returns its length
+inline int NumberToChars(const LuaValue& val, char* buf)
+{
+	if(val.isfloat)
+		return snprintf(buf, MAXNUMBER2STR, "%f", val.number);
+	return snprintf(buf, MAXNUMBER2STR, "%lld", (long long)val.integer);
 }
\ No newline at end of file
@@ -24,6 +24,7 @@ int BaseRawSet(LuaState* ls);
 int BaseType(LuaState* ls);
 int BaseToString(LuaState* ls);
 int BaseToNumber(LuaState* ls);
+int BaseCollectGarbage(LuaState* ls);
 
 static const FuncReg BaseFuncs[]
 {
@@ -48,6 +49,7 @@ static const FuncReg BaseFuncs[]
 	{"type", BaseType},
 	{"tostring", BaseToString},
 	{"tonumber", BaseToNumber},
+	{"collectgarbage", BaseCollectGarbage},
 	/* placeholders */
 	{"_G", nullptr},
 	{"_VERSION", nullptr},
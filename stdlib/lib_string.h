@@ -0,0 +1,12 @@
+#pragma once
+#include "state/lua_state.h"
+
+int StrDump(LuaState* ls);
+
+static const FuncReg StrFuncs[]
+{
+	{"dump", StrDump},
+	{nullptr, nullptr}
+};
+
+int OpenStringLib(LuaState* ls);
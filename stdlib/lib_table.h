@@ -0,0 +1,12 @@
+#pragma once
+#include "state/lua_state.h"
+
+int TabConcat(LuaState* ls);
+
+static const FuncReg TabFuncs[]
+{
+	{"concat", TabConcat},
+	{nullptr, nullptr}
+};
+
+int OpenTableLib(LuaState* ls);
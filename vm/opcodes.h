@@ -64,9 +64,9 @@ enum _OpCode
 	OP_TAILCALL,/*	A B C	return R(A)(R(A+1), ... ,R(A+B-1))		*/
 	OP_RETURN,/*	A B	return R(A), ... ,R(A+B-2)	(see note)	*/
 
-	OP_FORLOOP,/*	A sBx	R(A)+=R(A+2);
-				if R(A) <?= R(A+1) then { pc+=sBx; R(A+3)=R(A) }*/
-	OP_FORPREP,/*	A sBx	R(A)-=R(A+2); pc+=sBx				*/
+	OP_FORLOOP,/*	A sBx	if iterations left (integers, counted in R(A+1)) or R(A)+R(A+2) <?= R(A+1) (floats)
+				then { R(A)+=R(A+2); pc+=sBx; R(A+3)=R(A) }*/
+	OP_FORPREP,/*	A sBx	R(A+3)=R(A); if the loop never runs then pc+=sBx+1	*/
 
 	OP_TFORCALL,/*	A C	R(A+3), ... ,R(A+2+C) := R(A)(R(A+1), R(A+2));	*/
 	OP_TFORLOOP,/*	A sBx	if R(A+1) ~= nil then { R(A)=R(A+1); pc += sBx }*/
@@ -100,9 +100,6 @@ struct OpCode
 	Byte argCMode; /* C arg mode */
 	Byte opMode; /* op mode */
 	String name;
-
-	typedef void(*Func)(Instruction, LuaVM*);
-	Func action;
 };
 
 extern const OpCode opcodes[47];
@@ -125,6 +122,13 @@ struct Instruction
 		return int(value & 0x3F);
 	}
 
+	// Single fields, the interpreter decodes only what each opcode uses
+	inline int A() const { return int(value >> 6 & 0xFF); }
+	inline int B() const { return int(value >> 23 & 0x1FF); }
+	inline int C() const { return int(value >> 14 & 0x1FF); }
+	inline int Bx() const { return int(value >> 14); }
+	inline int sBx() const { return int(value >> 14) - MAXARG_sBX; }
+
 	inline std::tuple<int, int, int>/* a, b, c */ ABC() const
 	{
 		return std::make_tuple(
@@ -177,6 +181,4 @@ struct Instruction
 	{
 		return opcodes[Opcode()].argCMode;
 	}
-
-	void Execute(LuaVM *vm);
 };
\ No newline at end of file
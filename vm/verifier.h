@@ -0,0 +1,232 @@
+#pragma once
+#include "binchunk/binary_chunk.h"
+#include "vm/opcodes.h"
+
+// Checks a prototype and its nested ones once when it is loaded, compiled or undumped,
+// so that RunLuaClosure can trust the operands: registers stay below MaxStackSize,
+// constant, upvalue and prototype indices exist, jumps land inside the code
+// and the extra argument of LOADKX / SETLIST is there.
+struct Verifier
+{
+	const Prototype* proto;
+	int n;
+	int maxStack;
+	int nk;
+	int nup;
+
+	Verifier(const Prototype* p) : proto(p)
+	{
+		n = (int)p->Code.size();
+		maxStack = (int)p->MaxStackSize;
+		nk = (int)p->Constants.size();
+		nup = (int)p->Upvalues.size();
+	}
+
+	// registers r to r + count - 1
+	void CheckReg(int r, int count = 1) const
+	{
+		panic_cond(r >= 0 && r + count <= maxStack, "register out of the frame");
+	}
+
+	void CheckRK(int x) const
+	{
+		if(x > 0xFF)
+		{
+			panic_cond((x & 0xFF) < nk, "constant out of range");
+		}
+		else
+		{
+			CheckReg(x);
+		}
+	}
+
+	void CheckUpval(int i) const
+	{
+		panic_cond(i < nup, "upvalue out of range");
+	}
+
+	void CheckTarget(int target) const
+	{
+		panic_cond(target >= 0 && target < n, "jump out of the code");
+	}
+
+	// Size hint of NEWTABLE, a "floating point byte". Its shift must fit an int and the size
+	// can't exceed what the code fills in, perInst items per instruction (rounded up by 1/8)
+	void CheckSizeHint(int x, int perInst) const
+	{
+		panic_cond(x < 0xE8, "table size out of range");
+		panic_cond((Int64)Fb2int(x) <= (Int64)perInst * 2 * n, "table size out of range");
+	}
+
+	Instruction ExtraArg(int pc) const
+	{
+		panic_cond(pc + 1 < n, "missing EXTRAARG");
+		Instruction extra(proto->Code[pc + 1]);
+		panic_cond(extra.Opcode() == OP_EXTRAARG, "missing EXTRAARG");
+		return extra;
+	}
+
+	void Run() const
+	{
+		panic_cond(proto->NumParams <= proto->MaxStackSize, "parameters out of the frame");
+		panic_cond(n > 0 && Instruction(proto->Code[n - 1]).Opcode() == OP_RETURN, "code must end with RETURN");
+		for(int pc = 0; pc < n; ++pc)
+		{
+			Instruction inst(proto->Code[pc]);
+			panic_cond(inst.Opcode() <= OP_EXTRAARG, "invalid opcode");
+			int a = inst.A();
+			switch(inst.Opcode())
+			{
+				case OP_MOVE: CheckReg(a); CheckReg(inst.B()); break;
+				case OP_LOADK: CheckReg(a); panic_cond(inst.Bx() < nk, "constant out of range"); break;
+				case OP_LOADKX:
+				{
+					CheckReg(a);
+					panic_cond(ExtraArg(pc).Ax() < nk, "constant out of range");
+					++pc;
+					break;
+				}
+				case OP_LOADBOOL:
+				{
+					CheckReg(a);
+					if(inst.C())
+						CheckTarget(pc + 2);
+					break;
+				}
+				case OP_LOADNIL: CheckReg(a, inst.B() + 1); break;
+				case OP_GETUPVAL: CheckReg(a); CheckUpval(inst.B()); break;
+				case OP_GETTABUP: CheckReg(a); CheckUpval(inst.B()); CheckRK(inst.C()); break;
+				case OP_GETTABLE: CheckReg(a); CheckReg(inst.B()); CheckRK(inst.C()); break;
+				case OP_SETTABUP: CheckUpval(a); CheckRK(inst.B()); CheckRK(inst.C()); break;
+				case OP_SETUPVAL: CheckReg(a); CheckUpval(inst.B()); break;
+				case OP_SETTABLE: CheckReg(a); CheckRK(inst.B()); CheckRK(inst.C()); break;
+				case OP_NEWTABLE:
+				{
+					CheckReg(a);
+					// a SETLIST stores at most LFIELDS_PER_FLUSH items, a SETTABLE one
+					CheckSizeHint(inst.B(), LFIELDS_PER_FLUSH);
+					CheckSizeHint(inst.C(), 1);
+					break;
+				}
+				case OP_SELF: CheckReg(a, 2); CheckReg(inst.B()); CheckRK(inst.C()); break;
+				case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW: case OP_DIV:
+				case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
+				{
+					CheckReg(a);
+					CheckRK(inst.B());
+					CheckRK(inst.C());
+					break;
+				}
+				case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN: CheckReg(a); CheckReg(inst.B()); break;
+				case OP_CONCAT:
+				{
+					CheckReg(a);
+					panic_cond(inst.B() <= inst.C(), "invalid CONCAT range");
+					CheckReg(inst.B(), inst.C() - inst.B() + 1);
+					break;
+				}
+				case OP_JMP:
+				{
+					CheckTarget(pc + 1 + inst.sBx());
+					// A - 1 is the first register to close
+					panic_cond(a <= maxStack, "register out of the frame");
+					break;
+				}
+				case OP_EQ: case OP_LT: case OP_LE:
+				{
+					CheckRK(inst.B());
+					CheckRK(inst.C());
+					CheckTarget(pc + 2);
+					break;
+				}
+				case OP_TEST: CheckReg(a); CheckTarget(pc + 2); break;
+				case OP_TESTSET: CheckReg(a); CheckReg(inst.B()); CheckTarget(pc + 2); break;
+				case OP_CALL:
+				case OP_TAILCALL:
+				{
+					// B == 0 and C == 0 take the arguments or leave the results up to the top
+					CheckReg(a, std::max(inst.B(), 1));
+					if(inst.C() > 1)
+						CheckReg(a, inst.C() - 1);
+					break;
+				}
+				case OP_RETURN:
+				{
+					if(inst.B() > 1)
+						CheckReg(a, inst.B() - 1);
+					break;
+				}
+				case OP_FORLOOP:
+				{
+					CheckReg(a, 4);
+					CheckTarget(pc + 1 + inst.sBx());
+					break;
+				}
+				case OP_FORPREP:
+				{
+					// a loop that never runs skips the FORLOOP it jumps to
+					CheckReg(a, 4);
+					CheckTarget(pc + 1 + inst.sBx());
+					panic_cond(Instruction(proto->Code[pc + 1 + inst.sBx()]).Opcode() == OP_FORLOOP, "FORPREP without FORLOOP");
+					break;
+				}
+				case OP_TFORCALL:
+				{
+					CheckReg(a, 3 + inst.C());
+					panic_cond(pc + 1 < n && Instruction(proto->Code[pc + 1]).Opcode() == OP_TFORLOOP, "TFORCALL without TFORLOOP");
+					break;
+				}
+				case OP_TFORLOOP:
+				{
+					CheckReg(a, 2);
+					CheckTarget(pc + 1 + inst.sBx());
+					break;
+				}
+				case OP_SETLIST:
+				{
+					CheckReg(a, inst.B() + 1);
+					if(inst.C() == 0)
+					{
+						ExtraArg(pc);
+						++pc;
+					}
+					break;
+				}
+				case OP_CLOSURE:
+				{
+					CheckReg(a);
+					panic_cond(inst.Bx() < (int)proto->Protos.size(), "prototype out of range");
+					break;
+				}
+				case OP_VARARG:
+				{
+					CheckReg(a, std::max(inst.B() - 1, 1));
+					break;
+				}
+				case OP_EXTRAARG:
+				{
+					panic("unexpected EXTRAARG");
+					break;
+				}
+			}
+		}
+
+		for(const PrototypePtr& sub : proto->Protos)
+		{
+			// a closure captures registers or upvalues of this function
+			for(const Upvalue& uv : sub->Upvalues)
+			{
+				if(uv.Instack)
+					CheckReg(uv.Idx);
+				else
+					CheckUpval(uv.Idx);
+			}
+			Verifier(sub.get()).Run();
+		}
+	}
+};
+
+inline void VerifyProto(const Prototype* proto)
+{
+	Verifier(proto).Run();
+}